@@ -0,0 +1,102 @@
+#version 330
+
+#define COLOR_PHI 4.0
+#define NORMAL_PHI 64.0
+#define DEPTH_PHI 0.02
+#define ALBEDO_PHI 0.1
+
+in vec2 texcoord;
+
+uniform sampler2D colorSampler;
+uniform sampler2D geometrySampler;
+uniform sampler2D albedoSampler;
+
+uniform int stepSize;
+uniform int raysPerPixel;
+
+uniform bool demodulate;
+uniform bool remodulate;
+
+out vec4 fragColor;
+
+const float kernel[3] = float[](3.0 / 8.0, 1.0 / 4.0, 1.0 / 16.0);
+
+float luminance(vec3 color) {
+    return dot(color, vec3(0.2126, 0.7152, 0.0722));
+}
+
+// Texture detail is divided out before filtering and multiplied back after the last pass, so only lighting gets blurred.
+vec4 getIrradiance(ivec2 pixel) {
+    vec4 color = texelFetch(colorSampler, pixel, 0);
+    if(demodulate) color.rgb /= max(texelFetch(albedoSampler, pixel, 0).rgb, vec3(0.001));
+
+    return color;
+}
+
+void main() {
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    ivec2 size = textureSize(colorSampler, 0);
+
+    vec4 color = getIrradiance(pixel);
+    vec4 geometry = texelFetch(geometrySampler, pixel, 0);
+    vec3 albedo = texelFetch(albedoSampler, pixel, 0).rgb;
+
+    // Stray sun hits are far brighter than anything around them and would survive every edge-stopping weight,
+    // so the first pass clamps each pixel to the second brightest of its neighbours, which also catches pairs.
+    if(demodulate) {
+        float maxLuminance = 0.0, secondLuminance = 0.0;
+        for(int y = -1; y <= 1; y++) {
+            for(int x = -1; x <= 1; x++) {
+                ivec2 samplePixel = clamp(pixel + ivec2(x, y), ivec2(0), size - 1);
+                if(samplePixel == pixel) continue;
+
+                float sampleLuminance = luminance(getIrradiance(samplePixel).rgb);
+                secondLuminance = max(secondLuminance, min(maxLuminance, sampleLuminance));
+                maxLuminance = max(maxLuminance, sampleLuminance);
+            }
+        }
+
+        float centerLuminance = luminance(color.rgb);
+        if(centerLuminance > secondLuminance) color.rgb *= secondLuminance / centerLuminance;
+    }
+
+    // The targets are half floats, the sample count in alpha only has to stay finite for the colour tolerance.
+    fragColor = vec4(color.rgb, min(color.a, 65504.0));
+
+    // Sky pixels store a negative distance.
+    if(geometry.w >= 0.0) {
+        // Converged pixels need less smoothing, the colour tolerance shrinks with noise as samples accumulate.
+        float colorPhi = COLOR_PHI * float(raysPerPixel) / (max(color.a, 1.0) * float(stepSize));
+        float centerLuminance = luminance(color.rgb);
+
+        vec3 sum = vec3(0.0);
+        float weightSum = 0.0;
+
+        for(int y = -2; y <= 2; y++) {
+            for(int x = -2; x <= 2; x++) {
+                ivec2 samplePixel = pixel + ivec2(x, y) * stepSize;
+                if(any(lessThan(samplePixel, ivec2(0))) || any(greaterThanEqual(samplePixel, size))) continue;
+
+                vec3 sampleColor = getIrradiance(samplePixel).rgb;
+                vec4 sampleGeometry = texelFetch(geometrySampler, samplePixel, 0);
+                vec3 sampleAlbedo = texelFetch(albedoSampler, samplePixel, 0).rgb;
+
+                float luminanceDelta = luminance(sampleColor) - centerLuminance;
+                vec3 albedoDelta = sampleAlbedo - albedo;
+
+                float weight = kernel[abs(x)] * kernel[abs(y)];
+                weight *= exp(-luminanceDelta * luminanceDelta / colorPhi);
+                weight *= pow(max(dot(sampleGeometry.xyz, geometry.xyz), 0.0), NORMAL_PHI);
+                weight *= exp(-abs(sampleGeometry.w - geometry.w) / (geometry.w * DEPTH_PHI * float(stepSize)));
+                weight *= exp(-dot(albedoDelta, albedoDelta) / ALBEDO_PHI);
+
+                sum += sampleColor * weight;
+                weightSum += weight;
+            }
+        }
+
+        if(weightSum > 0.0) fragColor.rgb = sum / weightSum;
+    }
+
+    if(remodulate) fragColor.rgb *= max(albedo, vec3(0.001));
+}
\ No newline at end of file
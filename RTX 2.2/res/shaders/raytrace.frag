@@ -3,30 +3,64 @@
 
 #define SUN_COLOR vec3(1.0, 0.7, 0.4) * 300.0
 #define SUN_RADIUS 0.001
+#define SUN_EXPONENT (1.0 / SUN_RADIUS)
 
 #define SKY_BRIGHTNESS 0.8
 
-#define NULL_MATERIAL Material(vec3(0.0), 0.0, 0.0, 0.0, vec4(0.0), false)
-#define NULL_HIT_INFO HitInfo(false, 0.0, 0.0, vec3(0.0), vec2(0.0), NULL_MATERIAL)
+#define NULL_HIT_INFO HitInfo(false, 0.0, 0.0, vec3(0.0), vec2(0.0), -1)
 
-#define BOXES 7
-#define SPHERES 2
+#define NO_HIT 1e30
+// Geometry is stored as half floats, sky pixels mark their distance negative instead of writing NO_HIT.
+#define SKY_DISTANCE -1.0
+#define MAX_STORED_DISTANCE 65504.0
+#define MAX_DISTANCE 1000000.0
+#define BVH_STACK_SIZE 64
+
+#define SOBOL_DIMENSIONS 16u
+
+#define RUSSIAN_ROULETTE_DEPTH 3
+#define ADAPTIVE_SAMPLE_LIMIT 4
 
 in vec2 uv;
 
-uniform vec3 playerPosition;
-uniform vec3 playerRotation;
+// Written by the renderer right before this draw is submitted, see Renderer::render.
+layout(std140) uniform Camera {
+    vec3 playerPosition;
+    vec3 playerRotation;
+
+    vec3 lastPlayerPosition;
+    vec3 lastPlayerRotation;
+};
+
 uniform vec3 sunDirection;
 
 uniform vec2 screenResolution;
 
 uniform sampler2D backFrameSampler;
+uniform sampler2D backGeometrySampler;
+uniform sampler2D backVarianceSampler;
 uniform sampler2D albedoSampler;
 uniform sampler2D normalSampler;
 uniform sampler2D skyboxSampler;
 
-uniform float random;
-uniform float backFrameFactor;
+uniform samplerBuffer materialBuffer;
+uniform samplerBuffer primitiveBuffer;
+uniform samplerBuffer nodeBuffer;
+uniform samplerBuffer lightBuffer;
+
+uniform int nodeCount;
+uniform int lightCount;
+uniform float lightPower;
+uniform int raysPerPixel;
+uniform int maxBounces;
+
+uniform bool adaptiveSampling;
+uniform int errorLevel;
+
+uniform int frameIndex;
+uniform bool resetBackFrame;
+uniform bool lightSampling;
+uniform float historyLimit;
 
 uniform float dofFocusDistance;
 uniform float dofBlurSize;
@@ -51,14 +85,10 @@ struct Material {
 struct Sphere {
     vec3 position;
     float radius;
-
-    Material material;
 };
 struct Box {
     vec3 position;
     vec3 size;
-
-    Material material;
 };
 
 struct HitInfo {
@@ -70,12 +100,9 @@ struct HitInfo {
     vec3 normal;
     vec2 uv;
 
-    Material material;
+    int material;
 };
 
-uniform Box boxes[BOXES];
-uniform Sphere spheres[SPHERES];
-
 mat2 rotate(float angle) {
     float radAngle = radians(angle);
 
@@ -85,33 +112,153 @@ mat2 rotate(float angle) {
     return mat2(cos, -sin, sin, cos);
 }
 
-float hash(inout float seed) { 
-	return fract(sin(dot(vec2(seed += 0.1), vec2(12.9898, 4.1414))) * 43758.5453);
+// Same sampler as src/sampler.cpp: Owen-scrambled Sobol pairs with a per-dimension index shuffle, PCG past the Sobol budget.
+struct Sampler {
+    uint seed;
+    uint index;
+    uint dimension;
+    uint state;
+};
+
+uint pcg(uint value) {
+    uint state = value * 747796405u + 2891336453u;
+    uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+
+    return (word >> 22u) ^ word;
+}
+
+uint reverseBits(uint value) {
+    value = ((value >> 1u) & 0x55555555u) | ((value & 0x55555555u) << 1u);
+    value = ((value >> 2u) & 0x33333333u) | ((value & 0x33333333u) << 2u);
+    value = ((value >> 4u) & 0x0f0f0f0fu) | ((value & 0x0f0f0f0fu) << 4u);
+    value = ((value >> 8u) & 0x00ff00ffu) | ((value & 0x00ff00ffu) << 8u);
+
+    return (value >> 16u) | (value << 16u);
+}
+
+uint nestedUniformScramble(uint value, uint seed) {
+    value = reverseBits(value);
+
+    value += seed;
+    value ^= value * 0x6c50b47cu;
+    value ^= value * 0xb82f1e52u;
+    value ^= value * 0xc7afe638u;
+    value ^= value * 0x8d22f6e6u;
+
+    return reverseBits(value);
+}
+
+uint sobol(uint index, uint dimension) {
+    if(dimension == 0u) return reverseBits(index);
+
+    uint result = 0u;
+    for(uint direction = 1u << 31u; index != 0u; index >>= 1u, direction ^= direction >> 1u)
+        if((index & 1u) != 0u) result ^= direction;
+
+    return result;
+}
+
+float toFloat(uint value) {
+    return float(value >> 8u) / 16777216.0;
+}
+
+Sampler createSampler(uvec2 pixel, uint index) {
+    uint seed = pcg(pixel.x + pcg(pixel.y));
+    return Sampler(seed, index, 0u, pcg(seed ^ pcg(index)));
+}
+
+float nextRandom(inout Sampler sampler) {
+    sampler.dimension++;
+    sampler.state = sampler.state * 747796405u + 2891336453u;
+
+    uint word = ((sampler.state >> ((sampler.state >> 28u) + 4u)) ^ sampler.state) * 277803737u;
+    return toFloat((word >> 22u) ^ word);
 }
 
-vec2 hash2(inout float seed) {
-    return vec2(hash(seed), hash(seed));
+float get1D(inout Sampler sampler) {
+    if(sampler.dimension >= SOBOL_DIMENSIONS) return nextRandom(sampler);
+
+    uint shuffledIndex = nestedUniformScramble(sampler.index, pcg(sampler.seed ^ sampler.dimension));
+    uint value = nestedUniformScramble(sobol(shuffledIndex, 0u), pcg(sampler.seed ^ sampler.dimension ^ 0x9e3779b9u));
+
+    sampler.dimension++;
+    return toFloat(value);
 }
 
-vec3 hash3(inout float seed) {
-    return vec3(hash(seed), hash(seed), hash(seed));
+vec2 get2D(inout Sampler sampler) {
+    if(sampler.dimension + 1u >= SOBOL_DIMENSIONS) {
+        float x = nextRandom(sampler);
+        return vec2(x, nextRandom(sampler));
+    }
+
+    uint shuffledIndex = nestedUniformScramble(sampler.index, pcg(sampler.seed ^ sampler.dimension));
+    uint x = nestedUniformScramble(sobol(shuffledIndex, 0u), pcg(sampler.seed ^ sampler.dimension ^ 0x9e3779b9u));
+    uint y = nestedUniformScramble(sobol(shuffledIndex, 1u), pcg(sampler.seed ^ sampler.dimension ^ 0x85ebca6bu));
+
+    sampler.dimension += 2u;
+    return vec2(toFloat(x), toFloat(y));
 }
 
-vec3 randomSphereDirection(inout float seed) {
-    vec2 h = hash2(seed) * vec2(2.0, 6.28318530718) - vec2(1,0);
+vec3 randomSphereDirection(inout Sampler sampler) {
+    vec2 h = get2D(sampler) * vec2(2.0, 6.28318530718) - vec2(1,0);
     float phi = h.y;
 	return vec3(sqrt(1.0 -h.x * h.x) * vec2(sin(phi), cos(phi)), h.x);
 }
 
+float luminance(vec3 color) {
+    return dot(color, vec3(0.2126, 0.7152, 0.0722));
+}
+
+float powerHeuristic(float pdf, float otherPdf) {
+    return pdf * pdf / (pdf * pdf + otherPdf * otherPdf);
+}
+
 vec3 sky(Ray ray) {
     //vec3 skyColor = mix(vec3(0.666), vec3(0.7, 0.8, 1.0), ray.direction.y / 2.0 + 0.5);
     vec2 skyUv = vec2(atan(ray.direction.z, ray.direction.x), asin(ray.direction.y) * 2.0);
     skyUv = (skyUv / PI) / 2.0 + 0.5;
 
-    vec3 skyColor = texture2D(skyboxSampler, skyUv).rgb;
-    vec3 sunColor = mix(vec3(0.0), SUN_COLOR, pow(clamp(dot(ray.direction, normalize(sunDirection)), 0.0, 1.0), 1.0 / SUN_RADIUS));
+    return texture2D(skyboxSampler, skyUv).rgb * SKY_BRIGHTNESS;
+}
+vec3 sun(vec3 direction) {
+    return SUN_COLOR * pow(clamp(dot(direction, normalize(sunDirection)), 0.0, 1.0), SUN_EXPONENT);
+}
+
+// The sun is a cosine power lobe, sampling it exactly leaves only visibility and the surface response as noise.
+vec3 sampleSun(inout Sampler sampler) {
+    vec2 random = get2D(sampler);
+
+    float cosTheta = pow(random.x, 1.0 / (SUN_EXPONENT + 1.0));
+    float sinTheta = sqrt(max(1.0 - cosTheta * cosTheta, 0.0));
+    float phi = random.y * 2.0 * PI;
+
+    vec3 axis = normalize(sunDirection);
+    float axisSign = axis.z >= 0.0 ? 1.0 : -1.0;
+    float a = -1.0 / (axisSign + axis.z);
+    float b = axis.x * axis.y * a;
+
+    vec3 tangent = vec3(1.0 + axisSign * axis.x * axis.x * a, axisSign * b, -axisSign * axis.x);
+    vec3 bitangent = vec3(b, axisSign + axis.y * axis.y * a, -axis.y);
+
+    return (tangent * cos(phi) + bitangent * sin(phi)) * sinTheta + axis * cosTheta;
+}
+float sunPdf(vec3 direction) {
+    return (SUN_EXPONENT + 1.0) / (2.0 * PI) * pow(clamp(dot(direction, normalize(sunDirection)), 0.0, 1.0), SUN_EXPONENT);
+}
+
+// Density of normalize(mix(reflected, hemisphere, diffuse)) for a uniform hemisphere sample. The mix lies on a sphere of radius
+// diffuse around (1 - diffuse) * reflected, which contains the origin from diffuse 0.5 up so every direction has one preimage.
+float diffusePdf(vec3 direction, vec3 normal, vec3 reflected, float diffuse) {
+    vec3 center = reflected * (1.0 - diffuse);
+    float centerDot = dot(direction, center);
+
+    float distance = centerDot + sqrt(max(centerDot * centerDot - dot(center, center) + diffuse * diffuse, 0.0));
+    vec3 hemisphere = (direction * distance - center) / diffuse;
+
+    float cosine = dot(hemisphere, direction);
+    if(dot(hemisphere, normal) <= 0.0 || cosine <= 0.0) return 0.0;
 
-    return skyColor * SKY_BRIGHTNESS + sunColor;
+    return distance * distance / (2.0 * PI * diffuse * diffuse * cosine);
 }
 
 HitInfo checkSphere(Ray ray, Sphere sphere) {
@@ -130,10 +277,7 @@ HitInfo checkSphere(Ray ray, Sphere sphere) {
     texUv = (texUv / PI) / 2.0 + 0.5;
     texUv -= floor(texUv);
 
-    texUv *= sphere.material.uvInfo.zw;
-    texUv += sphere.material.uvInfo.xy;
-
-    return HitInfo(distance >= 0.0, distance, -b + h, normal, texUv, sphere.material);
+    return HitInfo(distance >= 0.0, distance, -b + h, normal, texUv, -1);
 }
 HitInfo checkBox(Ray ray, Box box) {
     vec3 delta = ray.position - box.position - box.size / 2.0;
@@ -159,37 +303,154 @@ HitInfo checkBox(Ray ray, Box box) {
 
     texUv -= floor(texUv);
 
-    texUv *= box.material.uvInfo.zw;
-    texUv += box.material.uvInfo.xy;
+    return HitInfo(tN >= 0.0, tN, tF, face, texUv, -1);
+}
+
+Material getMaterial(int id) {
+    vec4 colorDiffuse = texelFetch(materialBuffer, id * 3);
+    vec4 glassEmissive = texelFetch(materialBuffer, id * 3 + 1);
+    vec4 uvInfo = texelFetch(materialBuffer, id * 3 + 2);
 
-    return HitInfo(tN >= 0.0, tN, tF, face, texUv, box.material);
+    return Material(colorDiffuse.rgb, colorDiffuse.a, glassEmissive.x, glassEmissive.y, uvInfo, glassEmissive.z > 0.5);
 }
 
-HitInfo rayCast(Ray ray) {
-    HitInfo hitInfo = HitInfo(false, 1000000.0, 0.0, vec3(0.0), vec2(0.0), NULL_MATERIAL);
-    
-    for(int i = 0; i < BOXES; i++) {
-        HitInfo boxHitInfo = checkBox(ray, boxes[i]);
-        if(boxHitInfo.hit && boxHitInfo.distance < hitInfo.distance)
-            hitInfo = boxHitInfo;
-    }
-    for(int i = 0; i < SPHERES; i++) {
-        HitInfo sphereHitInfo = checkSphere(ray, spheres[i]);
-        if(sphereHitInfo.hit && sphereHitInfo.distance < hitInfo.distance)
-            hitInfo = sphereHitInfo;
+HitInfo checkPrimitive(Ray ray, int id) {
+    vec4 positionMaterial = texelFetch(primitiveBuffer, id * 2);
+    vec4 sizeType = texelFetch(primitiveBuffer, id * 2 + 1);
+
+    HitInfo hitInfo = sizeType.w > 0.5 ?
+        checkSphere(ray, Sphere(positionMaterial.xyz, sizeType.x)) :
+        checkBox(ray, Box(positionMaterial.xyz, sizeType.xyz));
+
+    hitInfo.material = int(positionMaterial.w);
+    return hitInfo;
+}
+
+float checkNode(Ray ray, vec3 inverseDirection, int node, float maxDistance) {
+    vec3 t1 = (texelFetch(nodeBuffer, node * 2).xyz - ray.position) * inverseDirection;
+    vec3 t2 = (texelFetch(nodeBuffer, node * 2 + 1).xyz - ray.position) * inverseDirection;
+
+    vec3 tMin = min(t1, t2);
+    vec3 tMax = max(t1, t2);
+
+    float tN = max(max(tMin.x, tMin.y), tMin.z);
+    float tF = min(min(tMax.x, tMax.y), tMax.z);
+
+    return (tF < tN || tF < 0.0 || tN > maxDistance) ? NO_HIT : tN;
+}
+
+// Shadow rays pass anyHit and stop at the first primitive they hit instead of searching for the closest one.
+HitInfo rayCast(Ray ray, float maxDistance, bool anyHit) {
+    HitInfo hitInfo = HitInfo(false, maxDistance, 0.0, vec3(0.0), vec2(0.0), -1);
+
+    vec3 inverseDirection = 1.0 / ray.direction;
+    if(nodeCount == 0 || checkNode(ray, inverseDirection, 0, hitInfo.distance) == NO_HIT) return hitInfo;
+
+    int stack[BVH_STACK_SIZE];
+    int stackSize = 0;
+    int node = 0;
+
+    while(true) {
+        vec4 minFirst = texelFetch(nodeBuffer, node * 2);
+        int count = int(texelFetch(nodeBuffer, node * 2 + 1).w);
+        int first = int(minFirst.w);
+
+        if(count > 0) {
+            for(int i = first; i < first + count; i++) {
+                HitInfo primitiveHitInfo = checkPrimitive(ray, i);
+                if(primitiveHitInfo.hit && primitiveHitInfo.distance < hitInfo.distance) {
+                    if(anyHit) return primitiveHitInfo;
+                    hitInfo = primitiveHitInfo;
+                }
+            }
+
+            if(stackSize == 0) break;
+            node = stack[--stackSize];
+
+            continue;
+        }
+
+        int nearNode = first;
+        int farNode = first + 1;
+
+        float nearDistance = checkNode(ray, inverseDirection, nearNode, hitInfo.distance);
+        float farDistance = checkNode(ray, inverseDirection, farNode, hitInfo.distance);
+
+        if(nearDistance > farDistance) {
+            nearNode = first + 1;
+            farNode = first;
+
+            float distance = nearDistance;
+            nearDistance = farDistance;
+            farDistance = distance;
+        }
+
+        if(nearDistance == NO_HIT) {
+            if(stackSize == 0) break;
+            node = stack[--stackSize];
+        } else {
+            node = nearNode;
+            if(farDistance != NO_HIT) stack[stackSize++] = farNode;
+        }
     }
 
     return hitInfo;
 }
 
-vec3 rayTrace(Ray ray, inout float seed) {
+// Picks an emissive primitive from the alias table built by src/lights.cpp and a point spread evenly over its surface.
+vec3 sampleLight(inout Sampler sampler, out int primitive) {
+    float random = get1D(sampler) * float(lightCount);
+    int bin = min(int(random), lightCount - 1);
+
+    vec4 light = texelFetch(lightBuffer, bin);
+    if(random - float(bin) >= light.y) light = texelFetch(lightBuffer, int(light.z));
+    primitive = int(light.x);
+
+    vec3 position = texelFetch(primitiveBuffer, primitive * 2).xyz;
+    vec4 sizeType = texelFetch(primitiveBuffer, primitive * 2 + 1);
+
+    float faceRandom = get1D(sampler);
+    vec2 pointRandom = get2D(sampler);
+
+    if(sizeType.w > 0.5) {
+        float z = pointRandom.x * 2.0 - 1.0;
+        float phi = pointRandom.y * 2.0 * PI;
+
+        return position + vec3(sqrt(1.0 - z * z) * vec2(cos(phi), sin(phi)), z) * sizeType.x;
+    }
+
+    vec3 faceAreas = sizeType.yzx * sizeType.zxy;
+    float face = faceRandom * (faceAreas.x + faceAreas.y + faceAreas.z);
+
+    if(face < faceAreas.x) return position + vec3(step(faceAreas.x * 0.5, face), pointRandom) * sizeType.xyz;
+
+    face -= faceAreas.x;
+    if(face < faceAreas.y) return position + vec3(pointRandom.y, step(faceAreas.y * 0.5, face), pointRandom.x) * sizeType.xyz;
+
+    face -= faceAreas.y;
+    return position + vec3(pointRandom, step(faceAreas.z * 0.5, face)) * sizeType.xyz;
+}
+
+vec3 rayTrace(Ray ray, inout Sampler sampler) {
     vec3 color = vec3(1.0);
+    vec3 light = vec3(0.0);
 
-    for(int i = 0; i < 64; i++) {
-        HitInfo hitInfo = rayCast(ray);
-        if(!hitInfo.hit) return color * sky(ray);
+    // Density the last bounce was sampled with when the sun was also sampled there, zero when only this path can find the sun.
+    float lastPdf = 0.0;
 
-        color *= hitInfo.material.color;
+    for(int i = 0; i < maxBounces; i++) {
+        HitInfo hitInfo = rayCast(ray, MAX_DISTANCE, false);
+        if(!hitInfo.hit) {
+            float weight = lastPdf > 0.0 ? powerHeuristic(lastPdf, sunPdf(ray.direction)) : 1.0;
+            return light + color * (sky(ray) + sun(ray.direction) * weight);
+        }
+
+        Material material = getMaterial(hitInfo.material);
+        hitInfo.uv = hitInfo.uv * material.uvInfo.zw + material.uvInfo.xy;
+
+        vec3 geometricNormal = hitInfo.normal;
+
+        color *= material.color;
 
         if(length(hitInfo.uv) > 0.0) {
             color *= texture2D(albedoSampler, hitInfo.uv).rgb;
@@ -210,63 +471,101 @@ vec3 rayTrace(Ray ray, inout float seed) {
             hitInfo.normal = normalize(-texturedNormal * tangentMatrix);
         }
 
-        if(hitInfo.material.emissive) return color;
+        if(material.emissive) {
+            if(lastPdf <= 0.0 || lightPower <= 0.0) return light + color;
+
+            float lightPdf = luminance(material.color) * hitInfo.distance * hitInfo.distance / (lightPower * abs(dot(geometricNormal, ray.direction)));
+            return light + color * powerHeuristic(lastPdf, lightPdf);
+        }
         
-        float fresnel = pow(clamp(1.0 - dot(hitInfo.normal, -ray.direction), 0.0, 1.0), 1.0 + hitInfo.material.glass);
-        float reflectChance = hash(seed) * (fresnel + hitInfo.material.glassReflect);
-        float sunDirectChance = hash(seed);
+        float fresnel = pow(clamp(1.0 - dot(hitInfo.normal, -ray.direction), 0.0, 1.0), 1.0 + material.glass);
+        float reflectChance = get1D(sampler) * (fresnel + material.glassReflect);
+        lastPdf = 0.0;
         
-        if(hitInfo.material.glass > 0.0 && reflectChance < 0.5) {
+        if(material.glass > 0.0 && reflectChance < 0.5) {
             ray.position += ray.direction * (hitInfo.farDistance - 0.001);
         
-            vec3 refracted = refract(ray.direction, hitInfo.normal, 1.0 - hitInfo.material.glass);
-            ray.direction = randomSphereDirection(seed);
+            vec3 refracted = refract(ray.direction, hitInfo.normal, 1.0 - material.glass);
+            ray.direction = randomSphereDirection(sampler);
             ray.direction *= sign(dot(ray.direction, -hitInfo.normal));
-            ray.direction = mix(refracted, ray.direction, hitInfo.material.diffuse);
+            ray.direction = mix(refracted, ray.direction, material.diffuse);
         } else {
             ray.position += ray.direction * (hitInfo.distance - 0.001);
             
             vec3 reflected = reflect(ray.direction, hitInfo.normal);
-            ray.direction = randomSphereDirection(seed);
+
+            // Rough surfaces also cast shadow rays at the sun and one emissive primitive, weighted against the bounce with the power heuristic.
+            if(lightSampling && material.diffuse >= 0.5) {
+                vec3 lightDirection = sampleSun(sampler);
+                float bouncePdf = diffusePdf(lightDirection, hitInfo.normal, reflected, material.diffuse);
+
+                if(bouncePdf > 0.0 && !rayCast(Ray(ray.position, lightDirection), MAX_DISTANCE, true).hit) {
+                    float lightPdf = sunPdf(lightDirection);
+                    light += color * sun(lightDirection) * bouncePdf / lightPdf * powerHeuristic(lightPdf, bouncePdf);
+                }
+
+                if(lightCount > 0) {
+                    int primitive;
+                    vec3 lightPoint = sampleLight(sampler, primitive);
+
+                    Ray lightRay = Ray(ray.position, normalize(lightPoint - ray.position));
+                    HitInfo lightHitInfo = checkPrimitive(lightRay, primitive);
+
+                    // Points on the far side of a light come back at its near side and are hidden by it.
+                    float lightDistance = length(lightPoint - ray.position);
+                    bool visible = lightHitInfo.hit && abs(lightHitInfo.distance - lightDistance) < lightDistance * 0.001 + 0.001;
+
+                    bouncePdf = diffusePdf(lightRay.direction, hitInfo.normal, reflected, material.diffuse);
+                    float cosine = abs(dot(lightHitInfo.normal, lightRay.direction));
+
+                    if(visible && bouncePdf > 0.0 && cosine > 0.0 && !rayCast(lightRay, lightHitInfo.distance * 0.999, true).hit) {
+                        Material lightMaterial = getMaterial(lightHitInfo.material);
+                        vec2 lightUv = lightHitInfo.uv * lightMaterial.uvInfo.zw + lightMaterial.uvInfo.xy;
+
+                        vec3 emission = lightMaterial.color;
+                        if(length(lightUv) > 0.0) emission *= texture2D(albedoSampler, lightUv).rgb;
+
+                        float lightPdf = luminance(lightMaterial.color) * lightHitInfo.distance * lightHitInfo.distance / (lightPower * cosine);
+                        light += color * emission * bouncePdf / lightPdf * powerHeuristic(lightPdf, bouncePdf);
+                    }
+                }
+            }
+
+            ray.direction = randomSphereDirection(sampler);
             ray.direction *= sign(dot(ray.direction, hitInfo.normal));
-            ray.direction = mix(reflected, ray.direction, hitInfo.material.diffuse);
+            ray.direction = normalize(mix(reflected, ray.direction, material.diffuse));
+
+            if(lightSampling && material.diffuse >= 0.5) lastPdf = diffusePdf(ray.direction, hitInfo.normal, reflected, material.diffuse);
         }
 
         ray.direction = normalize(ray.direction);
-    }
 
-    return vec3(0.0);
-}
+        // Dim paths are ended at random and the survivors brightened to match, which keeps the estimate unbiased.
+        if(i >= RUSSIAN_ROULETTE_DEPTH) {
+            float survival = clamp(max(color.r, max(color.g, color.b)), 0.05, 1.0);
+            if(get1D(sampler) >= survival) break;
 
-vec3 render(Ray ray, inout float seed, in int raysPerPixel) {
-    vec3 color;
-    for(int i = 0; i < raysPerPixel; i++) {
-        color += rayTrace(ray, seed);
-        seed += 394.392 / (float(i) + 1.0);
+            color /= survival;
+        }
     }
 
-    return clamp(color / float(raysPerPixel), vec3(0.0), vec3(1.0));
+    return light;
 }
 
-out vec4 fragColor;
-
-void main() {
-    float seed = (uv.x / (screenResolution.x / screenResolution.y) + uv.y) * 492.38 + random + (playerRotation.x + playerRotation.y + playerRotation.z) / 2.0;
+vec3 getAlbedo(HitInfo hitInfo) {
+    if(!hitInfo.hit) return vec3(1.0);
 
-    Ray ray = Ray(vec3(0.0), normalize(vec3(vec2(uv.x * (screenResolution.x / screenResolution.y), uv.y) * tan(radians(fov) / 2.0), 1.0)));
+    Material material = getMaterial(hitInfo.material);
+    vec2 uv = hitInfo.uv * material.uvInfo.zw + material.uvInfo.xy;
 
-    vec2 randomPoint = randomSphereDirection(seed).xy * dofBlurSize;
-
-    Ray focusRay = Ray(playerPosition, vec3(0.0, 0.0, 1.0));
-    focusRay.direction.yz *= rotate(-playerRotation.x);
-    focusRay.direction.xz *= rotate(-playerRotation.y);
-    focusRay.direction.zy *= rotate(-playerRotation.z);
-    
-    HitInfo focusHitInfo = rayCast(focusRay);
+    return length(uv) > 0.0 ? material.color * texture2D(albedoSampler, uv).rgb : material.color;
+}
 
-    vec3 focusPoint = ray.direction * (focusHitInfo.hit ? focusHitInfo.distance : dofFocusDistance);
+Ray cameraRay(vec3 direction, float focusDistance, inout Sampler sampler) {
+    vec2 randomPoint = randomSphereDirection(sampler).xy * dofBlurSize;
+    vec3 focusPoint = direction * focusDistance;
 
-    ray.position = vec3(randomPoint * (focusHitInfo.hit ? focusHitInfo.distance : dofFocusDistance), 0.0);
+    Ray ray = Ray(vec3(randomPoint * focusDistance, 0.0), vec3(0.0));
     ray.direction = normalize(focusPoint - ray.position);
 
     ray.position.yx *= rotate(-playerRotation.z);
@@ -279,9 +578,117 @@ void main() {
 
     ray.position += playerPosition;
 
-    fragColor = vec4(render(ray, seed, 128), 1.0);
+    return ray;
+}
+
+// Returns the mean colour and the mean squared luminance of the paths, the second moment feeds the variance estimate.
+vec4 render(vec3 direction, float focusDistance, int samples, uint firstSample) {
+    vec4 color = vec4(0.0);
+    for(int i = 0; i < samples; i++) {
+        Sampler sampler = createSampler(uvec2(gl_FragCoord.xy), firstSample + uint(i));
+        vec3 sampleColor = rayTrace(cameraRay(direction, focusDistance, sampler), sampler);
+
+        color += vec4(sampleColor, luminance(sampleColor) * luminance(sampleColor));
+    }
+
+    return color / float(samples);
+}
+
+vec3 toViewSpace(vec3 direction, vec3 rotation) {
+    direction.xz *= rotate(rotation.y);
+    direction.yz *= rotate(rotation.x);
+    direction.yx *= rotate(rotation.z);
+
+    return direction;
+}
+
+bool reproject(vec3 direction, HitInfo hitInfo, out vec4 backFrameColor, out vec4 backVariance) {
+    vec3 lastDirection = hitInfo.hit ? playerPosition + direction * hitInfo.distance - lastPlayerPosition : direction;
+    float lastDistance = length(lastDirection);
+
+    lastDirection = toViewSpace(lastDirection, lastPlayerRotation);
+    if(lastDirection.z <= 0.0) return false;
+
+    vec2 lastUv = lastDirection.xy / (lastDirection.z * tan(radians(fov) / 2.0));
+    lastUv.x /= screenResolution.x / screenResolution.y;
+    lastUv = lastUv / 2.0 + 0.5;
+
+    if(any(lessThan(lastUv, vec2(0.0))) || any(greaterThan(lastUv, vec2(1.0)))) return false;
+
+    // Reject history that saw a different surface: the sky must stay sky, geometry must match in distance and orientation.
+    vec4 lastGeometry = texture2D(backGeometrySampler, lastUv);
+    if(!hitInfo.hit) {
+        if(lastGeometry.w >= 0.0) return false;
+    }
+    else {
+        if(abs(lastGeometry.w - lastDistance) > lastDistance * 0.05 + 0.01) return false;
+        if(dot(lastGeometry.xyz, hitInfo.normal) < 0.9) return false;
+    }
+
+    backFrameColor = texture2D(backFrameSampler, lastUv);
+
+    // The sample index in w must not be blended between pixels.
+    backVariance = texelFetch(backVarianceSampler, ivec2(lastUv * vec2(textureSize(backVarianceSampler, 0))), 0);
+    return true;
+}
+
+layout(location = 0) out vec4 fragColor;
+layout(location = 1) out vec4 fragGeometry;
+layout(location = 2) out vec4 fragAlbedo;
+layout(location = 3) out vec4 fragVariance;
+
+void main() {
+    vec3 direction = normalize(vec3(vec2(uv.x * (screenResolution.x / screenResolution.y), uv.y) * tan(radians(fov) / 2.0), 1.0));
+
+    Ray focusRay = Ray(playerPosition, vec3(0.0, 0.0, 1.0));
+    focusRay.direction.yz *= rotate(-playerRotation.x);
+    focusRay.direction.xz *= rotate(-playerRotation.y);
+    focusRay.direction.zy *= rotate(-playerRotation.z);
     
-    vec4 backFrameColor = texture2D(backFrameSampler, uv / 2.0 + 0.5);
-    if(backFrameColor.a > 0.0)
-        fragColor.rgb = mix(backFrameColor.rgb, fragColor.rgb, backFrameFactor);
+    HitInfo focusHitInfo = rayCast(focusRay, MAX_DISTANCE, false);
+    float focusDistance = focusHitInfo.hit ? focusHitInfo.distance : dofFocusDistance;
+
+    vec3 primaryDirection = direction;
+    primaryDirection.yx *= rotate(-playerRotation.z);
+    primaryDirection.yz *= rotate(-playerRotation.x);
+    primaryDirection.xz *= rotate(-playerRotation.y);
+
+    HitInfo primaryHitInfo = rayCast(Ray(playerPosition, primaryDirection), MAX_DISTANCE, false);
+    fragGeometry = vec4(primaryHitInfo.normal, primaryHitInfo.hit ? min(primaryHitInfo.distance, MAX_STORED_DISTANCE) : SKY_DISTANCE);
+    fragAlbedo = vec4(getAlbedo(primaryHitInfo), 1.0);
+
+    vec4 backFrameColor, backVariance;
+    bool history = !resetBackFrame && reproject(primaryDirection, primaryHitInfo, backFrameColor, backVariance);
+
+    // Pixels without history start a fresh sequence, frameIndex keeps them from repeating it every frame while moving.
+    if(!history) backVariance = vec4(0.0, 0.0, 0.0, float(frameIndex * raysPerPixel));
+
+    // Variance: x is the mean squared luminance, y the relative error of the accumulated mean,
+    // z how many samples this frame spent and w the pixel's running sample index.
+    int samples = raysPerPixel;
+    if(adaptiveSampling && history && backFrameColor.a >= float(raysPerPixel)) {
+        // The top mip level of the last variance buffer holds the mean error, noisier pixels get a larger share of the budget.
+        float meanError = texelFetch(backVarianceSampler, ivec2(0), errorLevel).y;
+        samples = clamp(int(float(raysPerPixel) * backVariance.y / max(meanError, 1e-6) + 0.5), 1, raysPerPixel * ADAPTIVE_SAMPLE_LIMIT);
+    }
+
+    vec4 color = render(direction, focusDistance, samples, uint(backVariance.w));
+
+    fragColor = vec4(color.rgb, float(samples));
+    fragVariance = vec4(color.a, 0.0, float(samples), backVariance.w + float(samples));
+
+    if(history) {
+        // Alpha holds how many samples the pixel has accumulated, so the running mean stays exact in float.
+        // While the camera moves the count is capped so stale lighting fades out instead of smearing.
+        backFrameColor.a = min(backFrameColor.a, historyLimit);
+
+        fragColor.a += backFrameColor.a;
+        fragColor.rgb = mix(backFrameColor.rgb, color.rgb, float(samples) / fragColor.a);
+        fragVariance.x = mix(backVariance.x, color.a, float(samples) / fragColor.a);
+    }
+
+    float mean = luminance(fragColor.rgb);
+    float variance = max(fragVariance.x - mean * mean, 0.0);
+
+    fragVariance.y = sqrt(variance / fragColor.a) / (mean + 0.1);
 }
\ No newline at end of file
@@ -1,39 +1,39 @@
 #version 130
-#define GAUSSIAN_SAMPLES 12
-#define GAUSSIAN_SIGMA float(GAUSSIAN_SAMPLES) * 0.25
 
 varying vec2 texcoord;
 
 uniform vec2 screenResolution;
 uniform vec2 textureResolution;
 
+uniform float exposure;
+uniform int toneMapper;
+
+uniform bool heatMap;
+uniform float maxSamples;
+
 uniform sampler2D colorSampler;
+uniform sampler2D heatMapSampler;
+
+vec3 toneMap(vec3 color) {
+    color *= exposure;
+
+    if(toneMapper == 1) return color / (1.0 + color);
+    if(toneMapper == 2) return clamp((color * (2.51 * color + 0.03)) / (color * (2.43 * color + 0.59) + 0.14), 0.0, 1.0);
 
-float gaussian(vec2 uv) {
-    return exp(-0.5 * dot(uv /= GAUSSIAN_SIGMA, uv)) / (6.28 * GAUSSIAN_SIGMA * GAUSSIAN_SIGMA);
+    return clamp(color, 0.0, 1.0);
 }
 
-vec3 blur(sampler2D sampler, vec2 uv, vec2 resolution) {
-    vec4 result;
-    
-    float scale = 0.02;
-    int samples = GAUSSIAN_SAMPLES;
-    for(int i = 0; i < samples * samples; i++) {
-        vec2 d = vec2(i - floor(i / float(samples)) * float(samples), i / samples) - float(samples) / 2.0;
-        result += gaussian(d * scale) * texture2D(sampler, uv + d / 10.0 * scale);
-    }
-    
-    return result.rgb / result.a;
+// Blue for pixels that got a single sample, through green to red for ones that got the adaptive maximum.
+vec3 heatMapColor(float samples) {
+    float t = clamp(samples / maxSamples, 0.0, 1.0);
+    return clamp(vec3(2.0 * t - 1.0, 1.0 - abs(2.0 * t - 1.0), 1.0 - 2.0 * t), 0.0, 1.0);
 }
 
 void main() {
     gl_FragColor.a = 1.0;
 
-    gl_FragColor.rgb = texture2D(colorSampler, texcoord).rgb;
-    //vec3 blurredColor = blur(colorSampler, texcoord, screenResolution);
-    //gl_FragColor.rgb = mix(gl_FragColor.rgb, blurredColor, clamp(pow(length(gl_FragColor.rgb - blurredColor), 2.0) * 2.0, 0.0, 1.0));
-    //gl_FragColor.rgb *= 1.15;
-    //gl_FragColor.rgb = blurredColor;
+    gl_FragColor.rgb = toneMap(texture2D(colorSampler, texcoord).rgb);
+    if(heatMap) gl_FragColor.rgb = mix(gl_FragColor.rgb, heatMapColor(texture2D(heatMapSampler, texcoord).z), 0.75);
 
     vec2 uv = texcoord * 2.0 - 1.0;
     uv.x *= screenResolution.x / screenResolution.y;
@@ -0,0 +1,720 @@
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <random>
+#include <thread>
+#include "benchmark.h"
+#include "tracer.h"
+#include "sampler.h"
+#include "lights.h"
+#include "mapfile.h"
+
+int RTX::Benchmark::run(int argc, char** argv) {
+    std::string name = argc > 0 ? argv[0] : "";
+
+    if (name == "bvh") bvh();
+    else if (name == "convergence") convergence();
+    else if (name == "lights") lights();
+    else if (name == "load") load();
+    else if (name == "parser") parser();
+    else if (name == "path") return path(argc - 1, argv + 1) ? 0 : 1;
+    else if (name == "textures") return textures() ? 0 : 1;
+    else {
+        std::cerr << "Usage: --benchmark <bvh|convergence|lights|load|parser|textures>\n";
+        std::cerr << "       --benchmark path <map.rtmap> <camera.rtpath> [--frames N] [--size WxH] [--rpp N] [--image out.ppm]\n";
+        return 1;
+    }
+
+    return 0;
+}
+
+void RTX::Benchmark::bvh() {
+    const int rays = 100000;
+    const int validatedRays = 200;
+
+    Map* lastMap = World::map;
+
+    printf("%10s %10s %10s %8s %6s %10s %10s %10s %10s %9s %10s %10s %9s\n",
+        "primitives", "build ms", "nodes", "leaves", "depth", "SAH cost", "Mrays/s", "nodes/ray", "tests/ray", "mismatch", "query ns", "candidates", "missed");
+
+    for (int count : { 10000, 100000, 1000000 }) {
+        Map map = generateMap(count, 1337);
+        World::map = &map;
+
+        auto start = std::chrono::high_resolution_clock::now();
+
+        BVH bvh;
+        bvh.build(map.boxes, map.spheres);
+
+        std::chrono::duration<double, std::milli> buildTime = std::chrono::high_resolution_clock::now() - start;
+
+        glm::vec3 sceneMin = bvh.nodes[0].min;
+        glm::vec3 sceneSize = bvh.nodes[0].max - bvh.nodes[0].min;
+
+        std::mt19937 random(42);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+        std::vector<Ray> rayList;
+        rayList.reserve(rays);
+
+        for (int i = 0; i < rays; i++) {
+            glm::vec3 position = sceneMin + sceneSize * glm::vec3(unit(random), unit(random), unit(random));
+
+            float z = unit(random) * 2.0f - 1.0f;
+            float phi = unit(random) * 6.28318530718f;
+            glm::vec3 direction(glm::sqrt(1.0f - z * z) * glm::cos(phi), glm::sqrt(1.0f - z * z) * glm::sin(phi), z);
+
+            rayList.push_back({ position, direction });
+        }
+
+        int boxCount = (int)map.boxes.size();
+        auto test = [&](const Ray& ray, int primitive) {
+            return primitive < boxCount ? Tracer::checkBox(ray, map.boxes[primitive]) : Tracer::checkSphere(ray, map.spheres[primitive - boxCount]);
+        };
+
+        std::vector<float> distances(rays);
+        long long visitedNodes = 0, testedPrimitives = 0;
+
+        start = std::chrono::high_resolution_clock::now();
+
+        for (int i = 0; i < rays; i++) {
+            float distance = 1000000.0f;
+
+            visitedNodes += bvh.traverse(rayList[i], distance, [&](int primitive) {
+                HitInfo hitInfo = test(rayList[i], primitive);
+                if (hitInfo.hit && hitInfo.distance < distance) distance = hitInfo.distance;
+
+                testedPrimitives++;
+                return false;
+            });
+
+            distances[i] = distance;
+        }
+
+        std::chrono::duration<double> traceTime = std::chrono::high_resolution_clock::now() - start;
+
+        int mismatches = 0;
+        for (int i = 0; i < validatedRays; i++) {
+            float distance = 1000000.0f;
+            for (int primitive = 0; primitive < count; primitive++) {
+                HitInfo hitInfo = test(rayList[i], primitive);
+                if (hitInfo.hit && hitInfo.distance < distance) distance = hitInfo.distance;
+            }
+
+            if (glm::abs(distance - distances[i]) > 0.0001f) mismatches++;
+        }
+
+        // Player sized overlap queries, the broadphase behind Player::sweep.
+        std::vector<Bounds> queries;
+        for (int i = 0; i < rays; i++) {
+            glm::vec3 position = sceneMin + sceneSize * glm::vec3(unit(random), unit(random), unit(random));
+            queries.push_back(Bounds(position, position + glm::vec3(0.4f, 1.76f, 0.4f)));
+        }
+
+        std::vector<int> candidates;
+        long long candidateCount = 0;
+
+        start = std::chrono::high_resolution_clock::now();
+
+        for (const Bounds& query : queries) {
+            candidates.clear();
+            bvh.query(query, candidates);
+            candidateCount += candidates.size();
+        }
+
+        std::chrono::duration<double, std::nano> queryTime = std::chrono::high_resolution_clock::now() - start;
+
+        int missed = 0;
+        for (int i = 0; i < validatedRays; i++) {
+            candidates.clear();
+            bvh.query(queries[i], candidates);
+
+            for (int primitive = 0; primitive < count; primitive++) {
+                Bounds bounds = primitive < boxCount ? Bounds(map.boxes[primitive].position, map.boxes[primitive].position + map.boxes[primitive].scale)
+                    : Bounds(map.spheres[primitive - boxCount].position - map.spheres[primitive - boxCount].radius, map.spheres[primitive - boxCount].position + map.spheres[primitive - boxCount].radius);
+
+                bool overlaps = glm::all(glm::lessThanEqual(bounds.min, queries[i].max)) && glm::all(glm::greaterThanEqual(bounds.max, queries[i].min));
+                if (overlaps && std::find(candidates.begin(), candidates.end(), primitive) == candidates.end()) missed++;
+            }
+        }
+
+        printf("%10d %10.1f %10d %8d %6d %10.2f %10.2f %10.1f %10.1f %5d/%d %10.0f %10.2f %9d\n",
+            count, buildTime.count(), (int)bvh.nodes.size(), bvh.getLeafCount(), bvh.getDepth(), bvh.getCost(),
+            rays / traceTime.count() / 1000000.0, (double)visitedNodes / rays, (double)testedPrimitives / rays,
+            mismatches, validatedRays, queryTime.count() / rays, (double)candidateCount / rays, missed);
+    }
+
+    World::map = lastMap;
+}
+
+void RTX::Benchmark::convergence() {
+    const int pixels = 4096;
+    const int maxSamples = 256;
+
+    // Integrands with known values: a smooth 4D product like a lens sample followed by a bounce, and a 2D edge.
+    auto smooth = [](glm::vec2 a, glm::vec2 b) { return 16.0f * a.x * a.y * b.x * b.y; };
+    auto edge = [](glm::vec2 a, glm::vec2) { return a.x + a.y < 1.0f ? 2.0f : 0.0f; };
+
+    printf("integrand RMSE over %d pixels\n", pixels);
+    printf("%6s %8s %12s %12s %12s %10s\n", "spp", "test", "sine hash", "pcg", "sobol", "gain");
+
+    for (int samples = 1; samples <= maxSamples; samples *= 4) {
+        for (int test = 0; test < 2; test++) {
+            float errors[3];
+            int index = 0;
+
+            for (Sampler::Type type : { Sampler::Type::SineHash, Sampler::Type::Random, Sampler::Type::Sobol }) {
+                Sampler::type = type;
+
+                double sum = 0.0;
+                for (int pixel = 0; pixel < pixels; pixel++) {
+                    double estimate = 0.0;
+                    for (int i = 0; i < samples; i++) {
+                        Sampler sampler(glm::uvec2(pixel % 64, pixel / 64), i);
+
+                        glm::vec2 a = sampler.get2D();
+                        glm::vec2 b = sampler.get2D();
+                        estimate += test == 0 ? smooth(a, b) : edge(a, b);
+                    }
+
+                    double delta = estimate / samples - 1.0;
+                    sum += delta * delta;
+                }
+
+                errors[index++] = (float)glm::sqrt(sum / pixels);
+            }
+
+            printf("%6d %8s %12.5f %12.5f %12.5f %9.2fx\n", samples, test == 0 ? "smooth" : "edge", errors[0], errors[1], errors[2], errors[0] / errors[2]);
+        }
+    }
+
+    const glm::uvec2 size(96, 54);
+    const int referenceSamples = 2048;
+
+    const glm::vec3 eyePosition(-1.3f, 6.56f, -1.3f);
+    const glm::vec3 rotation(10.0f, 30.0f, 0.0f);
+
+    Map map = MapParser::parse("res/maps/old.rtmap", false);
+    BVH bvh;
+    bvh.build(map.boxes, map.spheres);
+    LightList lights;
+    lights.build(map);
+
+    Map* lastMap = World::map;
+    BVH* lastBvh = World::bvh;
+    LightList* lastLights = World::lights;
+    World::map = &map;
+    World::bvh = &bvh;
+    World::lights = &lights;
+
+    World::sunDirection[0] = -1.0f;
+    World::sunDirection[1] = 1.0f;
+    World::sunDirection[2] = -0.175f;
+
+    TT::ThreadPool::initialize();
+    Tracer::initialize(size);
+    Tracer::raysPerPixel = 1;
+
+    // One sample per frame so the lens and every bounce advance through the sequence together.
+    auto accumulate = [&](Sampler::Type type, unsigned int scramble, int samples) {
+        Sampler::type = type;
+        Sampler::scramble = scramble;
+
+        Tracer::resetDenoiser();
+        for (int i = 0; i < samples; i++) Tracer::render(eyePosition, rotation);
+    };
+
+    // The reference uses a different scramble, otherwise the Sobol runs would replay its first points and look better than they are.
+    auto start = std::chrono::high_resolution_clock::now();
+    accumulate(Sampler::Type::Sobol, 1, referenceSamples);
+    std::vector<glm::vec4> reference = Tracer::getPixels();
+
+    std::chrono::duration<double> referenceTime = std::chrono::high_resolution_clock::now() - start;
+    printf("\nold.rtmap RMSE, reference: %dx%d, %d spp, %.1f s\n", size.x, size.y, referenceSamples, referenceTime.count());
+
+    printf("%6s %12s %12s %12s %10s\n", "spp", "sine hash", "pcg", "sobol", "gain");
+
+    for (int samples = 1; samples <= maxSamples; samples *= 2) {
+        float errors[3];
+        int index = 0;
+
+        for (Sampler::Type type : { Sampler::Type::SineHash, Sampler::Type::Random, Sampler::Type::Sobol }) {
+            accumulate(type, 0, samples);
+            errors[index++] = getImageError(Tracer::getPixels(), reference);
+        }
+
+        printf("%6d %12.5f %12.5f %12.5f %9.2fx\n", samples, errors[0], errors[1], errors[2], errors[0] / errors[2]);
+    }
+
+    Sampler::type = Sampler::Type::Sobol;
+    Sampler::scramble = 0;
+
+    Tracer::clear();
+    TT::ThreadPool::clear();
+
+    World::map = lastMap;
+    World::bvh = lastBvh;
+    World::lights = lastLights;
+}
+
+void RTX::Benchmark::lights() {
+    const glm::uvec2 size(96, 54);
+    const int referenceSamples = 1024;
+    const int maxSamples = 64;
+
+    struct Scene {
+        const char* location;
+        glm::vec3 eyePosition, rotation;
+    };
+
+    const Scene scenes[] = {
+        { "res/maps/old.rtmap", glm::vec3(-1.3f, 6.56f, -1.3f), glm::vec3(10.0f, 30.0f, 0.0f) },
+        { "res/maps/obby.rtmap", glm::vec3(0.0f, 2.6f, -2.0f), glm::vec3(10.0f, 0.0f, 0.0f) },
+        { "res/maps/obby.rtmap", glm::vec3(-6.0f, 3.2f, 17.0f), glm::vec3(10.0f, -90.0f, 0.0f) }
+    };
+
+    Map* lastMap = World::map;
+    BVH* lastBvh = World::bvh;
+    LightList* lastLights = World::lights;
+
+    World::sunDirection[0] = -1.0f;
+    World::sunDirection[1] = 1.0f;
+    World::sunDirection[2] = -0.175f;
+
+    TT::ThreadPool::initialize();
+    Tracer::resize(size);
+    Tracer::raysPerPixel = 1;
+
+    for (const Scene& scene : scenes) {
+        Map map = MapParser::parse(scene.location, false);
+        BVH bvh;
+        bvh.build(map.boxes, map.spheres);
+        LightList lights;
+        lights.build(map);
+
+        World::map = &map;
+        World::bvh = &bvh;
+        World::lights = &lights;
+
+        Tracer::reloadTextures();
+
+        auto accumulate = [&](bool lightSampling, unsigned int scramble, int samples) {
+            Tracer::lightSampling = lightSampling;
+            Sampler::scramble = scramble;
+
+            Tracer::resetDenoiser();
+            for (int i = 0; i < samples; i++) Tracer::render(scene.eyePosition, scene.rotation);
+        };
+
+        // Both estimators converge to the same image, so one reference serves both and its error shows any bias.
+        accumulate(true, 1, referenceSamples);
+        std::vector<glm::vec4> reference = Tracer::getPixels();
+
+        printf("%s RMSE, %d lights, reference: %dx%d, %d spp with light sampling\n", scene.location, (int)lights.lights.size(), size.x, size.y, referenceSamples);
+        printf("%6s %12s %14s %14s %10s %10s\n", "spp", "bounce only", "light sampled", "variance gain", "rays", "ms/frame");
+
+        for (int samples = 1; samples <= maxSamples; samples *= 4) {
+            float errors[2];
+            double rays[2], frameTimes[2];
+
+            for (int lightSampling = 0; lightSampling < 2; lightSampling++) {
+                unsigned long long startRayCount = Tracer::getRayCount();
+                auto start = std::chrono::high_resolution_clock::now();
+
+                accumulate(lightSampling == 1, 0, samples);
+
+                std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start;
+                rays[lightSampling] = (double)(Tracer::getRayCount() - startRayCount) / samples / (size.x * size.y);
+                frameTimes[lightSampling] = elapsed.count() / samples;
+
+                errors[lightSampling] = getImageError(Tracer::getPixels(), reference);
+            }
+
+            printf("%6d %12.4f %14.4f %13.1fx %4.1f/%4.1f %4.1f/%4.1f\n", samples, errors[0], errors[1],
+                (errors[0] * errors[0]) / (errors[1] * errors[1]), rays[0], rays[1], frameTimes[0], frameTimes[1]);
+        }
+
+        printf("\n");
+    }
+
+    Tracer::lightSampling = true;
+    Sampler::scramble = 0;
+
+    Tracer::clear();
+    TT::ThreadPool::clear();
+
+    World::map = lastMap;
+    World::bvh = lastBvh;
+    World::lights = lastLights;
+}
+
+void RTX::Benchmark::load() {
+    const double minimumTime = 250.0;
+
+    struct Scene {
+        std::string name, location;
+    };
+
+    std::vector<Scene> scenes = {
+        { "old", "res/maps/old.rtmap" },
+        { "obby", "res/maps/obby.rtmap" },
+        { "obsidian_showcase", "res/maps/obsidian_showcase.rtmap" }
+    };
+
+    // Generated maps go through the same text format first, so both paths start from a file on disk.
+    for (int count : { 10000, 100000 }) {
+        Scene scene = { "generated " + std::to_string(count), "benchmark_" + std::to_string(count) + ".rtmap" };
+        saveMap(generateMap(count, 1337), scene.location.c_str());
+
+        scenes.push_back(scene);
+    }
+
+    printf("%-20s %10s %10s %10s %10s %10s %10s %10s\n", "map", "primitives", "text KB", "binary KB", "parse ms", "build ms", "load ms", "speedup");
+
+    for (const Scene& scene : scenes) {
+        std::string compiledLocation = scene.location + "b";
+        MapFile::compile(scene.location.c_str(), compiledLocation.c_str());
+
+        // Small maps load in microseconds, so each path repeats until the total is long enough to time.
+        auto measure = [&](auto run) {
+            int iterations = 0;
+            auto start = std::chrono::high_resolution_clock::now();
+            std::chrono::duration<double, std::milli> elapsed;
+
+            do {
+                run();
+                iterations++;
+                elapsed = std::chrono::high_resolution_clock::now() - start;
+            } while (elapsed.count() < minimumTime);
+
+            return elapsed.count() / iterations;
+        };
+
+        double parseTime = measure([&]() { MapParser::parse(scene.location.c_str(), false); });
+
+        Map map = MapParser::parse(scene.location.c_str(), false);
+        double buildTime = measure([&]() { BVH bvh; bvh.build(map.boxes, map.spheres); });
+
+        BVH bvh;
+        double loadTime = measure([&]() { MapFile::load(compiledLocation.c_str(), bvh, false); });
+
+        BVH builtBvh;
+        builtBvh.build(map.boxes, map.spheres);
+        Map loadedMap = MapFile::load(compiledLocation.c_str(), bvh, false);
+
+        if (loadedMap.boxes.size() != map.boxes.size() || loadedMap.spheres.size() != map.spheres.size() || bvh.nodes.size() != builtBvh.nodes.size() || bvh.getCost() != builtBvh.getCost())
+            std::cerr << scene.location << ": the compiled map does not match its source\n";
+
+        printf("%-20s %10d %10.1f %10.1f %10.3f %10.3f %10.3f %9.1fx\n", scene.name.c_str(), (int)(map.boxes.size() + map.spheres.size()),
+            std::filesystem::file_size(scene.location) / 1024.0, std::filesystem::file_size(compiledLocation) / 1024.0,
+            parseTime, buildTime, loadTime, (parseTime + buildTime) / loadTime);
+
+        std::filesystem::remove(compiledLocation);
+        if (scene.location.starts_with("benchmark_")) std::filesystem::remove(scene.location);
+    }
+}
+
+void RTX::Benchmark::parser() {
+    const char* location = "benchmark_parser.rtmap";
+
+    printf("%10s %10s %10s %10s %10s %10s %10s\n", "primitives", "MB", "read ms", "read MB/s", "parse ms", "parse MB/s", "of read");
+
+    // 1.5 million primitives come out at about 100 MB of text.
+    for (int count : { 10000, 100000, 1000000, 1500000 }) {
+        saveMap(generateMap(count, 1337), location);
+        double megabytes = std::filesystem::file_size(location) / 1048576.0;
+
+        // Both runs find the file in the page cache, reading it into memory is the bound the parser is held to.
+        auto start = std::chrono::high_resolution_clock::now();
+        {
+            std::ifstream file(location, std::ios::binary);
+            std::vector<char> data((size_t)std::filesystem::file_size(location));
+            file.read(data.data(), data.size());
+        }
+        std::chrono::duration<double, std::milli> readTime = std::chrono::high_resolution_clock::now() - start;
+
+        start = std::chrono::high_resolution_clock::now();
+        Map map = MapParser::parse(location, false);
+        std::chrono::duration<double, std::milli> parseTime = std::chrono::high_resolution_clock::now() - start;
+
+        if ((int)(map.boxes.size() + map.spheres.size()) != count) std::cerr << "Parsed " << map.boxes.size() + map.spheres.size() << " of " << count << " primitives\n";
+
+        printf("%10d %10.1f %10.2f %10.0f %10.2f %10.0f %9.0f%%\n", count, megabytes, readTime.count(), megabytes / readTime.count() * 1000.0,
+            parseTime.count(), megabytes / parseTime.count() * 1000.0, readTime.count() / parseTime.count() * 100.0);
+    }
+
+    std::filesystem::remove(location);
+}
+
+bool RTX::Benchmark::path(int argc, char** argv) {
+    if (argc < 2) {
+        std::cerr << "Usage: --benchmark path <map.rtmap> <camera.rtpath> [--frames N] [--size WxH] [--rpp N] [--image out.ppm]\n";
+        return false;
+    }
+
+    const char* mapLocation = argv[0];
+    const char* pathLocation = argv[1];
+    const char* imageLocation = NULL;
+
+    int frames = 60;
+    int raysPerPixel = 1;
+    glm::uvec2 size(320, 180);
+
+    for (int i = 2; i + 1 < argc; i += 2) {
+        std::string option = argv[i];
+
+        if (option == "--frames") frames = glm::max(atoi(argv[i + 1]), 1);
+        else if (option == "--rpp") raysPerPixel = glm::max(atoi(argv[i + 1]), 1);
+        else if (option == "--size") sscanf(argv[i + 1], "%ux%u", &size.x, &size.y);
+        else if (option == "--image") imageLocation = argv[i + 1];
+        else {
+            std::cerr << "Unknown option: " << option << "\n";
+            return false;
+        }
+    }
+
+    // Everything a player waits for counts towards the first frame: parsing, building and the render itself.
+    auto start = std::chrono::high_resolution_clock::now();
+
+    std::vector<Keyframe> keyframes = parsePath(pathLocation);
+
+    Map map = MapParser::parse(mapLocation, false);
+    BVH bvh;
+    bvh.build(map.boxes, map.spheres);
+    LightList lights;
+    lights.build(map);
+
+    Map* lastMap = World::map;
+    BVH* lastBvh = World::bvh;
+    LightList* lastLights = World::lights;
+    World::map = &map;
+    World::bvh = &bvh;
+    World::lights = &lights;
+
+    World::sunDirection[0] = -1.0f;
+    World::sunDirection[1] = 1.0f;
+    World::sunDirection[2] = -0.175f;
+
+    TT::ThreadPool::initialize();
+    Tracer::initialize(size);
+    Tracer::raysPerPixel = raysPerPixel;
+
+    std::chrono::duration<double, std::milli> loadTime = std::chrono::high_resolution_clock::now() - start;
+
+    double firstFrameTime = 0.0, totalFrameTime = 0.0;
+    double minFrameTime = INFINITY, maxFrameTime = 0.0;
+
+    unsigned long long startRayCount = Tracer::getRayCount();
+    unsigned long long startTestCount = Tracer::getPrimitiveTestCount();
+
+    for (int frame = 0; frame < frames; frame++) {
+        // Keyframes are spread evenly over the run and blended linearly, the last frame lands on the last keyframe.
+        float position = frames > 1 ? (float)frame / (frames - 1) * (keyframes.size() - 1) : 0.0f;
+        int keyframe = glm::min((int)position, (int)keyframes.size() - 1);
+        int nextKeyframe = glm::min(keyframe + 1, (int)keyframes.size() - 1);
+
+        float blend = position - keyframe;
+        glm::vec3 eyePosition = glm::mix(keyframes[keyframe].position, keyframes[nextKeyframe].position, blend);
+        glm::vec3 rotation = glm::mix(keyframes[keyframe].rotation, keyframes[nextKeyframe].rotation, blend);
+
+        auto frameStart = std::chrono::high_resolution_clock::now();
+
+        Tracer::resetDenoiser();
+        Tracer::render(eyePosition, rotation);
+
+        auto frameEnd = std::chrono::high_resolution_clock::now();
+        double frameTime = std::chrono::duration<double, std::milli>(frameEnd - frameStart).count();
+
+        if (frame == 0) firstFrameTime = std::chrono::duration<double, std::milli>(frameEnd - start).count();
+
+        totalFrameTime += frameTime;
+        minFrameTime = glm::min(minFrameTime, frameTime);
+        maxFrameTime = glm::max(maxFrameTime, frameTime);
+    }
+
+    double rays = (double)(Tracer::getRayCount() - startRayCount);
+    double tests = (double)(Tracer::getPrimitiveTestCount() - startTestCount);
+
+    printf("{\n");
+    printf("    \"map\": ");
+    printJsonString(mapLocation);
+    printf(",\n    \"path\": ");
+    printJsonString(pathLocation);
+    printf(",\n    \"renderer\": ");
+    printJsonString("cpu");
+    printf(",\n");
+    printf("    \"threads\": %u,\n", TT::ThreadPool::getThreadCount());
+    printf("    \"width\": %u,\n", size.x);
+    printf("    \"height\": %u,\n", size.y);
+    printf("    \"rays_per_pixel\": %d,\n", raysPerPixel);
+    printf("    \"frames\": %d,\n", frames);
+    printf("    \"primitives\": %d,\n", (int)(map.boxes.size() + map.spheres.size()));
+    printf("    \"load_ms\": %.3f,\n", loadTime.count());
+    printf("    \"time_to_first_frame_ms\": %.3f,\n", firstFrameTime);
+    printf("    \"ms_per_frame\": %.3f,\n", totalFrameTime / frames);
+    printf("    \"ms_per_frame_min\": %.3f,\n", minFrameTime);
+    printf("    \"ms_per_frame_max\": %.3f,\n", maxFrameTime);
+    printf("    \"rays_per_second\": %.0f,\n", rays / (totalFrameTime / 1000.0));
+    printf("    \"rays_per_frame\": %.0f,\n", rays / frames);
+    printf("    \"primitives_per_ray\": %.3f\n", tests / rays);
+    printf("}\n");
+
+    bool saved = !imageLocation || Tracer::saveToFile(imageLocation);
+
+    Tracer::clear();
+    TT::ThreadPool::clear();
+
+    World::map = lastMap;
+    World::bvh = lastBvh;
+    World::lights = lastLights;
+
+    return saved;
+}
+bool RTX::Benchmark::textures() {
+    const char* cacheLocation = "cache/textures";
+
+    const std::vector<const char*> maps = { "res/maps/old.rtmap", "res/maps/obby.rtmap", "res/maps/obsidian_showcase.rtmap" };
+
+    // Uploads need a context, the window stays up only for the run.
+    if (!TT::Window::create(640, 360, "Texture benchmark", false, false)) {
+        std::cerr << "Could not create a window...\n";
+        return false;
+    }
+
+    TT::ThreadPool::initialize();
+
+    printf("%-20s %6s %10s %10s %8s\n", "map", "cache", "first ms", "all ms", "uploads");
+
+    for (const char* location : maps) {
+        Map map = MapParser::parse(location, false);
+
+        // The cold run decodes the sources and writes the cache, the warm run right after reads it back.
+        for (bool cold : { true, false }) {
+            if (cold) std::filesystem::remove_all(cacheLocation);
+
+            auto start = std::chrono::high_resolution_clock::now();
+            map.loadTextures();
+
+            int uploads = 0;
+            std::chrono::duration<double, std::milli> firstTime(0.0);
+
+            while (TT::Texture::isLoading()) {
+                if (!TT::Texture::update()) {
+                    std::this_thread::yield();
+                    continue;
+                }
+
+                if (!uploads++) {
+                    glFinish();
+                    firstTime = std::chrono::high_resolution_clock::now() - start;
+                }
+            }
+
+            glFinish();
+            std::chrono::duration<double, std::milli> allTime = std::chrono::high_resolution_clock::now() - start;
+
+            if (uploads != 3) std::cerr << location << ": uploaded " << uploads << " of 3 textures\n";
+
+            printf("%-20s %6s %10.2f %10.2f %8d\n", std::filesystem::path(location).stem().string().c_str(), cold ? "cold" : "warm",
+                firstTime.count(), allTime.count(), uploads);
+
+            TT::Texture::clear(map.albedoTexture);
+            TT::Texture::clear(map.normalTexture);
+            TT::Texture::clear(map.skyboxTexture);
+        }
+    }
+
+    TT::ThreadPool::clear();
+    TT::Window::close();
+
+    return true;
+}
+
+std::vector<RTX::Benchmark::Keyframe> RTX::Benchmark::parsePath(const char* location) {
+    std::ifstream file(location);
+    if (!file.is_open()) throw std::runtime_error(std::string("Could not parse camera path: \"" + std::string(location) + "\""));
+
+    // One keyframe per line as "x,y,z/pitch,yaw,roll", with the same comment style as maps.
+    std::vector<Keyframe> keyframes;
+
+    std::string line;
+    while (getline(file, line)) {
+        if (line == "" || line.starts_with("//")) continue;
+
+        std::replace(line.begin(), line.end(), ',', ' ');
+        std::replace(line.begin(), line.end(), '/', ' ');
+
+        Keyframe keyframe;
+        std::stringstream lineStream(line);
+        if (lineStream >> keyframe.position.x >> keyframe.position.y >> keyframe.position.z >> keyframe.rotation.x >> keyframe.rotation.y >> keyframe.rotation.z)
+            keyframes.push_back(keyframe);
+    }
+
+    if (keyframes.empty()) throw std::runtime_error(std::string("Camera path has no keyframes: \"" + std::string(location) + "\""));
+    return keyframes;
+}
+
+RTX::Map RTX::Benchmark::generateMap(int primitives, unsigned int seed) {
+    std::mt19937 random(seed);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+    // Keeps the density of an obby course: one platform per 8x8x8 meters on average.
+    float side = glm::pow((float)primitives, 1.0f / 3.0f) * 8.0f;
+
+    std::vector<Material> materials = { Material(glm::vec3(0.8f), 0.999f, 0.0f, 0.0f, glm::vec4(0.0f), false) };
+    int floorTag = Tags::intern("floor");
+
+    std::vector<Box> boxes;
+    std::vector<Sphere> spheres;
+
+    for (int i = 0; i < primitives; i++) {
+        glm::vec3 position = glm::vec3(unit(random), unit(random), unit(random)) * side;
+
+        if (i % 10 == 9) spheres.push_back(Sphere(position, 0.5f + unit(random) * 1.5f, 0, floorTag));
+        else boxes.push_back(Box(position, glm::vec3(1.0f + unit(random) * 5.0f, 0.25f + unit(random), 1.0f + unit(random) * 5.0f), 0, floorTag));
+    }
+
+    return Map(0, 0, 0, materials, boxes, spheres);
+}
+void RTX::Benchmark::saveMap(const Map& map, const char* location) {
+    std::ofstream file(location);
+    file.precision(9);
+
+    // The parser adds the texture folder back.
+    auto getName = [](const std::string& location) { return std::filesystem::path(location).filename().string(); };
+
+    file << "Info\n" << getName(map.albedoLocation) << "/" << getName(map.normalLocation) << "/" << getName(map.skyboxLocation) << "\n\nMaterials\n";
+    for (const Material& material : map.materials) {
+        file << material.color.x << "," << material.color.y << "," << material.color.z << "/" << material.diffuse << "/" << material.glass << "/" << material.glassReflect << "/";
+        file << material.uvInfo.x << "," << material.uvInfo.y << "," << material.uvInfo.z << "," << material.uvInfo.w << "/" << (material.emissive ? "true" : "false") << "\n";
+    }
+
+    file << "\nBoxes\n";
+    for (const Box& box : map.boxes)
+        file << box.position.x << "," << box.position.y << "," << box.position.z << "/" << box.scale.x << "," << box.scale.y << "," << box.scale.z << "/" << box.material << "/" << Tags::getName(box.tag) << "\n";
+
+    file << "\nSpheres\n";
+    for (const Sphere& sphere : map.spheres)
+        file << sphere.position.x << "," << sphere.position.y << "," << sphere.position.z << "/" << sphere.radius << "/" << sphere.material << "/" << Tags::getName(sphere.tag) << "\n";
+}
+float RTX::Benchmark::getImageError(const std::vector<glm::vec4>& pixels, const std::vector<glm::vec4>& reference) {
+    // Errors are measured on the clamped image the screen pass shows, raw HDR error is dominated by a few bright hits.
+    double sum = 0.0;
+    for (size_t i = 0; i < pixels.size(); i++) {
+        glm::vec3 delta = glm::clamp(glm::vec3(pixels[i]), 0.0f, 1.0f) - glm::clamp(glm::vec3(reference[i]), 0.0f, 1.0f);
+        sum += glm::dot(delta, delta) / 3.0f;
+    }
+
+    return (float)glm::sqrt(sum / pixels.size());
+}
+void RTX::Benchmark::printJsonString(const char* value) {
+    putchar('"');
+
+    for (const char* c = value; *c; c++) {
+        if (*c == '"' || *c == '\\') printf("\\%c", *c);
+        else if ((unsigned char)*c < 0x20) printf("\\u%04x", (unsigned char)*c);
+        else putchar(*c);
+    }
+
+    putchar('"');
+}
\ No newline at end of file
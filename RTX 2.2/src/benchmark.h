@@ -0,0 +1,30 @@
+#pragma once
+#include "rtx.h"
+
+namespace RTX {
+    class Benchmark {
+    public:
+        static int run(int argc, char** argv);
+
+        static void bvh();
+        static void convergence();
+        static void lights();
+        static void load();
+        static void parser();
+        static bool path(int argc, char** argv);
+        // Times the three map textures from loadFromFileAsync until they are uploaded, with the cache cleared and then kept.
+        static bool textures();
+    private:
+        struct Keyframe {
+            glm::vec3 position, rotation;
+        };
+
+        static std::vector<Keyframe> parsePath(const char* location);
+
+        static Map generateMap(int primitives, unsigned int seed);
+        static void saveMap(const Map& map, const char* location);
+        static float getImageError(const std::vector<glm::vec4>& pixels, const std::vector<glm::vec4>& reference);
+        // Prints the string quoted, with quotes, backslashes and control characters escaped.
+        static void printJsonString(const char* value);
+    };
+}
\ No newline at end of file
@@ -0,0 +1,255 @@
+#include "bvh.h"
+
+RTX::Bounds::Bounds() : min(INFINITY), max(-INFINITY) {}
+RTX::Bounds::Bounds(glm::vec3 min, glm::vec3 max) : min(min), max(max) {}
+
+void RTX::Bounds::grow(glm::vec3 point) {
+    min = glm::min(min, point);
+    max = glm::max(max, point);
+}
+void RTX::Bounds::grow(const Bounds& bounds) {
+    min = glm::min(min, bounds.min);
+    max = glm::max(max, bounds.max);
+}
+
+float RTX::Bounds::getArea() const {
+    glm::vec3 extent = max - min;
+    if (extent.x < 0.0f) return 0.0f;
+
+    return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+}
+
+void RTX::BVH::build(const std::vector<Box>& boxes, const std::vector<Sphere>& spheres) {
+    static_assert(sizeof(Node) == 32, "BVH nodes must stay 32 bytes");
+
+    clear();
+
+    int count = (int)(boxes.size() + spheres.size());
+    if (count == 0) return;
+
+    primitiveBounds.reserve(count);
+    centroids.reserve(count);
+    primitives.reserve(count);
+
+    for (const Box& box : boxes)
+        primitiveBounds.push_back(Bounds(box.position, box.position + box.scale));
+    for (const Sphere& sphere : spheres)
+        primitiveBounds.push_back(Bounds(sphere.position - sphere.radius, sphere.position + sphere.radius));
+
+    for (int i = 0; i < count; i++) {
+        centroids.push_back((primitiveBounds[i].min + primitiveBounds[i].max) * 0.5f);
+        primitives.push_back(i);
+    }
+
+    nodes.reserve(count * 2);
+    nodes.resize(2);
+
+    nodes[0].leftFirst = 0;
+    nodes[0].count = count;
+    updateBounds(0);
+
+    std::vector<std::pair<int, int>> stack = { { 0, 1 } };
+    while (!stack.empty()) {
+        auto [node, depth] = stack.back();
+        stack.pop_back();
+
+        if (depth >= maxDepth || !subdivide(node)) continue;
+
+        stack.push_back({ nodes[node].leftFirst, depth + 1 });
+        stack.push_back({ nodes[node].leftFirst + 1, depth + 1 });
+    }
+
+    primitiveBounds.clear();
+    primitiveBounds.shrink_to_fit();
+    centroids.clear();
+    centroids.shrink_to_fit();
+}
+void RTX::BVH::clear() {
+    nodes.clear();
+    primitives.clear();
+    primitiveBounds.clear();
+    centroids.clear();
+}
+
+void RTX::BVH::query(const Bounds& bounds, std::vector<int>& result) const {
+    if (nodes.empty()) return;
+
+    int stack[maxDepth];
+    int stackSize = 0;
+
+    int node = 0;
+    while (true) {
+        const Node& current = nodes[node];
+
+        bool overlaps = current.min.x <= bounds.max.x && current.max.x >= bounds.min.x
+            && current.min.y <= bounds.max.y && current.max.y >= bounds.min.y
+            && current.min.z <= bounds.max.z && current.max.z >= bounds.min.z;
+
+        if (overlaps && current.count > 0) result.insert(result.end(), primitives.begin() + current.leftFirst, primitives.begin() + current.leftFirst + current.count);
+        else if (overlaps) {
+            node = current.leftFirst;
+            stack[stackSize++] = current.leftFirst + 1;
+
+            continue;
+        }
+
+        if (stackSize == 0) break;
+        node = stack[--stackSize];
+    }
+}
+
+float RTX::BVH::getCost() const {
+    if (nodes.empty()) return 0.0f;
+
+    float rootArea = Bounds(nodes[0].min, nodes[0].max).getArea();
+    if (rootArea <= 0.0f) return 0.0f;
+
+    float cost = 0.0f;
+    for (size_t i = 0; i < nodes.size(); i++) {
+        if (i == 1) continue;
+
+        float area = Bounds(nodes[i].min, nodes[i].max).getArea() / rootArea;
+        cost += nodes[i].count > 0 ? area * nodes[i].count : area;
+    }
+
+    return cost;
+}
+int RTX::BVH::getDepth() const {
+    if (nodes.empty()) return 0;
+
+    int depth = 0;
+
+    std::vector<std::pair<int, int>> stack = { { 0, 1 } };
+    while (!stack.empty()) {
+        auto [node, nodeDepth] = stack.back();
+        stack.pop_back();
+
+        depth = glm::max(depth, nodeDepth);
+        if (nodes[node].count > 0) continue;
+
+        stack.push_back({ nodes[node].leftFirst, nodeDepth + 1 });
+        stack.push_back({ nodes[node].leftFirst + 1, nodeDepth + 1 });
+    }
+
+    return depth;
+}
+int RTX::BVH::getLeafCount() const {
+    int leaves = 0;
+    for (size_t i = 0; i < nodes.size(); i++)
+        if (i != 1 && nodes[i].count > 0) leaves++;
+
+    return leaves;
+}
+
+void RTX::BVH::updateBounds(int node) {
+    Bounds bounds;
+    for (int i = 0; i < nodes[node].count; i++)
+        bounds.grow(primitiveBounds[primitives[nodes[node].leftFirst + i]]);
+
+    nodes[node].min = bounds.min;
+    nodes[node].max = bounds.max;
+}
+bool RTX::BVH::subdivide(int node) {
+    int first = nodes[node].leftFirst;
+    int count = nodes[node].count;
+
+    if (count <= 1) return false;
+
+    Bounds centroidBounds;
+    for (int i = 0; i < count; i++) centroidBounds.grow(centroids[primitives[first + i]]);
+
+    int bestAxis = -1, bestSplit = 0;
+    float bestCost = INFINITY;
+
+    for (int axis = 0; axis < 3; axis++) {
+        float extent = centroidBounds.max[axis] - centroidBounds.min[axis];
+        if (extent <= 0.0f) continue;
+
+        Bounds binBounds[bins];
+        int binCounts[bins] = {};
+
+        float scale = bins / extent;
+        for (int i = 0; i < count; i++) {
+            int primitive = primitives[first + i];
+            int bin = glm::min(bins - 1, (int)((centroids[primitive][axis] - centroidBounds.min[axis]) * scale));
+
+            binBounds[bin].grow(primitiveBounds[primitive]);
+            binCounts[bin]++;
+        }
+
+        float leftAreas[bins - 1], rightAreas[bins - 1];
+        int leftCounts[bins - 1], rightCounts[bins - 1];
+
+        Bounds leftBounds, rightBounds;
+        int leftCount = 0, rightCount = 0;
+
+        for (int i = 0; i < bins - 1; i++) {
+            leftCount += binCounts[i];
+            leftBounds.grow(binBounds[i]);
+            leftCounts[i] = leftCount;
+            leftAreas[i] = leftBounds.getArea();
+
+            rightCount += binCounts[bins - 1 - i];
+            rightBounds.grow(binBounds[bins - 1 - i]);
+            rightCounts[bins - 2 - i] = rightCount;
+            rightAreas[bins - 2 - i] = rightBounds.getArea();
+        }
+
+        for (int i = 0; i < bins - 1; i++) {
+            if (leftCounts[i] == 0 || rightCounts[i] == 0) continue;
+
+            float cost = leftCounts[i] * leftAreas[i] + rightCounts[i] * rightAreas[i];
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestAxis = axis;
+                bestSplit = i;
+            }
+        }
+    }
+
+    if (bestAxis < 0) return false;
+
+    // Traversing a node costs about as much as testing one primitive, keep small leaves when splitting does not pay off.
+    float area = Bounds(nodes[node].min, nodes[node].max).getArea();
+    if (count <= maxLeafSize && area + bestCost >= count * area) return false;
+
+    float scale = bins / (centroidBounds.max[bestAxis] - centroidBounds.min[bestAxis]);
+    float minimum = centroidBounds.min[bestAxis];
+
+    int* middle = std::partition(&primitives[first], &primitives[first] + count, [&](int primitive) {
+        return glm::min(bins - 1, (int)((centroids[primitive][bestAxis] - minimum) * scale)) <= bestSplit;
+    });
+
+    int leftCount = (int)(middle - &primitives[first]);
+    if (leftCount == 0 || leftCount == count) return false;
+
+    int leftChild = (int)nodes.size();
+    nodes.resize(nodes.size() + 2);
+
+    nodes[leftChild].leftFirst = first;
+    nodes[leftChild].count = leftCount;
+    nodes[leftChild + 1].leftFirst = first + leftCount;
+    nodes[leftChild + 1].count = count - leftCount;
+
+    nodes[node].leftFirst = leftChild;
+    nodes[node].count = 0;
+
+    updateBounds(leftChild);
+    updateBounds(leftChild + 1);
+
+    return true;
+}
+
+float RTX::BVH::intersectNode(const Ray& ray, glm::vec3 inverseDirection, const Node& node, float maxDistance) {
+    glm::vec3 t1 = (node.min - ray.position) * inverseDirection;
+    glm::vec3 t2 = (node.max - ray.position) * inverseDirection;
+
+    glm::vec3 tMin = glm::min(t1, t2);
+    glm::vec3 tMax = glm::max(t1, t2);
+
+    float entryDistance = glm::max(glm::max(tMin.x, tMin.y), tMin.z);
+    float exitDistance = glm::min(glm::min(tMax.x, tMax.y), tMax.z);
+
+    if (exitDistance < entryDistance || exitDistance < 0.0f || entryDistance > maxDistance) return INFINITY;
+    return entryDistance;
+}
\ No newline at end of file
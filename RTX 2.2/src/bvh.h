@@ -0,0 +1,130 @@
+#pragma once
+#include <cstdlib>
+#include <new>
+#include "rtx.h"
+
+namespace RTX {
+    struct Ray {
+        glm::vec3 position;
+        glm::vec3 direction;
+    };
+    struct Bounds {
+        glm::vec3 min, max;
+
+        Bounds();
+        Bounds(glm::vec3 min, glm::vec3 max);
+
+        void grow(glm::vec3 point);
+        void grow(const Bounds& bounds);
+
+        float getArea() const;
+    };
+
+    template<typename T, size_t Alignment> struct AlignedAllocator {
+        typedef T value_type;
+        template<typename U> struct rebind { typedef AlignedAllocator<U, Alignment> other; };
+
+        AlignedAllocator() = default;
+        template<typename U> AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+        T* allocate(size_t count) {
+            return static_cast<T*>(::operator new(count * sizeof(T), std::align_val_t(Alignment)));
+        }
+        void deallocate(T* pointer, size_t) {
+            ::operator delete(pointer, std::align_val_t(Alignment));
+        }
+
+        template<typename U> bool operator==(const AlignedAllocator<U, Alignment>&) const { return true; }
+        template<typename U> bool operator!=(const AlignedAllocator<U, Alignment>&) const { return false; }
+    };
+
+    // Binned SAH hierarchy over a map's boxes and spheres. Primitive ids below the box count are boxes,
+    // the rest are spheres offset by the box count.
+    class BVH {
+    public:
+        struct alignas(32) Node {
+            glm::vec3 min;
+            int leftFirst;
+
+            glm::vec3 max;
+            int count;
+        };
+
+        // Node 1 is left empty so every sibling pair starts on an even index and shares one cache line.
+        std::vector<Node, AlignedAllocator<Node, 64>> nodes;
+        std::vector<int> primitives;
+
+        void build(const std::vector<Box>& boxes, const std::vector<Sphere>& spheres);
+        void clear();
+
+        template<typename T> int traverse(const Ray& ray, const float& maxDistance, T intersect) const;
+        // Appends every primitive whose bounds touch the given ones, boundaries included.
+        void query(const Bounds& bounds, std::vector<int>& result) const;
+
+        float getCost() const;
+        int getDepth() const;
+        int getLeafCount() const;
+    private:
+        const static int bins = 16;
+        const static int maxDepth = 64;
+        const static int maxLeafSize = 8;
+
+        std::vector<Bounds> primitiveBounds;
+        std::vector<glm::vec3> centroids;
+
+        void updateBounds(int node);
+        bool subdivide(int node);
+
+        static float intersectNode(const Ray& ray, glm::vec3 inverseDirection, const Node& node, float maxDistance);
+    };
+
+    template<typename T> int BVH::traverse(const Ray& ray, const float& maxDistance, T intersect) const {
+        if (nodes.empty()) return 0;
+
+        glm::vec3 inverseDirection = 1.0f / ray.direction;
+        if (intersectNode(ray, inverseDirection, nodes[0], maxDistance) == INFINITY) return 1;
+
+        int stack[maxDepth];
+        int stackSize = 0;
+
+        int node = 0;
+        int visited = 0;
+
+        while (true) {
+            visited++;
+            const Node& current = nodes[node];
+
+            if (current.count > 0) {
+                for (int i = 0; i < current.count; i++)
+                    if (intersect(primitives[current.leftFirst + i])) return visited;
+
+                if (stackSize == 0) break;
+                node = stack[--stackSize];
+
+                continue;
+            }
+
+            int nearChild = current.leftFirst;
+            int farChild = current.leftFirst + 1;
+
+            float nearDistance = intersectNode(ray, inverseDirection, nodes[nearChild], maxDistance);
+            float farDistance = intersectNode(ray, inverseDirection, nodes[farChild], maxDistance);
+
+            if (nearDistance > farDistance) {
+                std::swap(nearChild, farChild);
+                std::swap(nearDistance, farDistance);
+            }
+
+            if (nearDistance == INFINITY) {
+                if (stackSize == 0) break;
+                node = stack[--stackSize];
+            }
+            else {
+                node = nearChild;
+                if (farDistance != INFINITY) stack[stackSize++] = farChild;
+            }
+        }
+
+        return visited;
+    }
+}
\ No newline at end of file
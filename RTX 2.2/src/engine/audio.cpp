@@ -1,18 +1,41 @@
+#include <algorithm>
+#include <chrono>
 #include "audio.h"
 
+// Each stream buffer holds about 0.19 s at 44.1 kHz, the thread tops them up well before the queue runs dry.
+const static std::chrono::milliseconds streamInterval = std::chrono::milliseconds(20);
+
 ALCcontext* TT::AudioSystem::context = NULL;
 ALCdevice* TT::AudioSystem::device = NULL;
 
+std::unordered_map<ALuint, TT::AudioSystem::Stream*> TT::AudioSystem::streams;
+std::mutex TT::AudioSystem::streamMutex;
+std::thread TT::AudioSystem::streamThread;
+std::atomic<bool> TT::AudioSystem::running = false;
+
 void TT::AudioSystem::initialize() {
-	ALCdevice* device = alcOpenDevice(NULL);
+	device = alcOpenDevice(NULL);
 	if (!device) throw std::runtime_error("Could not open OpenAL device.");
 
-	ALCcontext* context = alcCreateContext(device, NULL);
+	context = alcCreateContext(device, NULL);
 	if (!context) throw std::runtime_error("Could not create OpenAL context.");
 
 	if (!alcMakeContextCurrent(context)) throw std::runtime_error("Could not bind OpenAL context.");
+
+	running = true;
+	streamThread = std::thread([]() {
+		while (running) {
+			updateStreams();
+			std::this_thread::sleep_for(streamInterval);
+		}
+	});
 }
 void TT::AudioSystem::clear() {
+	running = false;
+	if (streamThread.joinable()) streamThread.join();
+
+	while (!streams.empty()) stopStream(streams.begin()->first);
+
 	alcMakeContextCurrent(NULL);
 	alcDestroyContext(context);
 	alcCloseDevice(device);
@@ -38,6 +61,92 @@ void TT::AudioSystem::clear(ALuint sound) {
 	alDeleteBuffers(1, &sound);
 }
 
+void TT::AudioSystem::startStream(ALuint source, const char* location, bool loop) {
+	int error;
+	stb_vorbis* vorbis = stb_vorbis_open_filename(location, &error, NULL);
+	if (!vorbis) throw std::runtime_error(("Could not read file: \"" + std::string(location) + '\"'));
+
+	stb_vorbis_info info = stb_vorbis_get_info(vorbis);
+
+	Stream* stream = new Stream();
+	stream->vorbis = vorbis;
+	stream->channels = std::min(info.channels, 2);
+	stream->format = stream->channels == 1 ? AL_FORMAT_MONO16 : AL_FORMAT_STEREO16;
+	stream->sampleRate = (int)info.sample_rate;
+	stream->loop = loop;
+	stream->finished = false;
+
+	alGenBuffers(Stream::bufferCount, stream->buffers);
+
+	int filled = 0;
+	while (filled < Stream::bufferCount && fillBuffer(*stream, stream->buffers[filled])) filled++;
+	alSourceQueueBuffers(source, filled, stream->buffers);
+
+	std::lock_guard<std::mutex> lock(streamMutex);
+	streams[source] = stream;
+}
+void TT::AudioSystem::stopStream(ALuint source) {
+	std::lock_guard<std::mutex> lock(streamMutex);
+
+	auto iterator = streams.find(source);
+	if (iterator == streams.end()) return;
+
+	Stream* stream = iterator->second;
+	streams.erase(iterator);
+
+	// Detaching the queue hands every buffer back, so they can be deleted.
+	alSourceStop(source);
+	alSourcei(source, AL_BUFFER, 0);
+	alDeleteBuffers(Stream::bufferCount, stream->buffers);
+
+	stb_vorbis_close(stream->vorbis);
+	delete stream;
+}
+
+void TT::AudioSystem::updateStreams() {
+	std::lock_guard<std::mutex> lock(streamMutex);
+
+	for (auto& [source, stream] : streams) {
+		ALint processed, queued, state;
+		alGetSourcei(source, AL_BUFFERS_PROCESSED, &processed);
+
+		while (processed-- > 0) {
+			ALuint buffer;
+			alSourceUnqueueBuffers(source, 1, &buffer);
+
+			if (fillBuffer(*stream, buffer)) alSourceQueueBuffers(source, 1, &buffer);
+		}
+
+		// A source that ran dry stops on its own, a paused or finished one is left alone.
+		alGetSourcei(source, AL_BUFFERS_QUEUED, &queued);
+		alGetSourcei(source, AL_SOURCE_STATE, &state);
+		if (state == AL_STOPPED && queued > 0 && !stream->finished) alSourcePlay(source);
+	}
+}
+bool TT::AudioSystem::fillBuffer(Stream& stream, ALuint buffer) {
+	short pcm[Stream::bufferFrames * 2];
+	int frames = 0;
+
+	// Loops restart the decoder inside the same buffer, so the seam never waits on a refill.
+	bool restarted = false;
+	while (frames < Stream::bufferFrames && !stream.finished) {
+		int decoded = stb_vorbis_get_samples_short_interleaved(stream.vorbis, stream.channels, pcm + frames * stream.channels, (Stream::bufferFrames - frames) * stream.channels);
+		frames += decoded;
+
+		if (decoded > 0) restarted = false;
+		else if (stream.loop && !restarted) {
+			stb_vorbis_seek_start(stream.vorbis);
+			restarted = true;
+		}
+		else stream.finished = true;
+	}
+
+	if (frames == 0) return false;
+
+	alBufferData(buffer, stream.format, pcm, frames * stream.channels * sizeof(short), stream.sampleRate);
+	return true;
+}
+
 TT::SoundSource::SoundSource() {
 	alGenSources(1, &id);
 }
@@ -52,7 +161,21 @@ void TT::SoundSource::play(ALuint sound, float volume, float pitch, bool loop) c
 
 	unpause();
 }
+void TT::SoundSource::stream(const char* location, float volume, float pitch, bool loop) const {
+	stop();
+
+	// Queued buffers would repeat on their own with AL_LOOPING, the stream loops in the decoder instead.
+	alSourcei(id, AL_BUFFER, 0);
+	alSourcef(id, AL_GAIN, volume);
+	alSourcef(id, AL_PITCH, pitch);
+	alSourcei(id, AL_LOOPING, AL_FALSE);
+
+	AudioSystem::startStream(id, location, loop);
+
+	unpause();
+}
 void TT::SoundSource::clear() {
+	AudioSystem::stopStream(id);
 	alDeleteSources(1, &id);
 }
 
@@ -63,6 +186,7 @@ void TT::SoundSource::unpause() const {
 	alSourcePlay(id);
 }
 void TT::SoundSource::stop() const {
+	AudioSystem::stopStream(id);
 	alSourceStop(id);
 }
 
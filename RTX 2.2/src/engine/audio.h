@@ -1,7 +1,11 @@
 #pragma once
 #include <alc.h>
 #include <al.h>
+#include <atomic>
 #include <iostream>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 
 #define STB_VORBIS_HEADER_ONLY
 #include "../stb/stb_vorbis.c"
@@ -15,14 +19,43 @@ namespace TT {
 		static ALuint loadFromFile(const char* location);
 		static void clear(ALuint sound);
 	private:
+		friend class SoundSource;
+
+		// A file decoded a few buffers ahead of playback, refilled by the audio thread.
+		struct Stream {
+			static const int bufferCount = 4;
+			static const int bufferFrames = 8192;
+
+			stb_vorbis* vorbis;
+			ALuint buffers[bufferCount];
+
+			ALenum format;
+			int channels, sampleRate;
+
+			bool loop, finished;
+		};
+
 		static ALCcontext* context;
 		static ALCdevice* device;
+
+		static std::unordered_map<ALuint, Stream*> streams;
+		static std::mutex streamMutex;
+		static std::thread streamThread;
+		static std::atomic<bool> running;
+
+		static void startStream(ALuint source, const char* location, bool loop);
+		static void stopStream(ALuint source);
+
+		static void updateStreams();
+		static bool fillBuffer(Stream& stream, ALuint buffer);
 	};
 	class SoundSource {
 	public:
 		SoundSource();
 
 		void play(ALuint sound, float volume, float pitch, bool loop) const;
+		// For long tracks: decodes on the audio thread while playing instead of loading the whole file up front.
+		void stream(const char* location, float volume, float pitch, bool loop) const;
 		void clear();
 
 		void pause() const;
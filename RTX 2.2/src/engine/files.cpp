@@ -0,0 +1,78 @@
+#include "files.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+TT::MappedFile::MappedFile(const char* location) : data(NULL), size(0), handle(NULL) {
+#ifdef _WIN32
+	HANDLE file = CreateFileA(location, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) return;
+
+	LARGE_INTEGER fileSize;
+	if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0) {
+		HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+
+		if (mapping) {
+			data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+
+			if (data) {
+				size = (size_t)fileSize.QuadPart;
+				handle = mapping;
+			}
+			else CloseHandle(mapping);
+		}
+	}
+
+	CloseHandle(file);
+#else
+	int file = open(location, O_RDONLY);
+	if (file < 0) return;
+
+	struct stat status;
+	if (fstat(file, &status) == 0 && status.st_size > 0) {
+		void* mapping = mmap(NULL, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+
+		if (mapping != MAP_FAILED) {
+			data = mapping;
+			size = (size_t)status.st_size;
+		}
+	}
+
+	// The mapping keeps its own reference to the file.
+	::close(file);
+#endif
+}
+
+void TT::MappedFile::clear() {
+	if (!data) return;
+
+#ifdef _WIN32
+	UnmapViewOfFile(data);
+	CloseHandle((HANDLE)handle);
+#else
+	munmap((void*)data, size);
+#endif
+
+	data = NULL;
+	size = 0;
+	handle = NULL;
+}
+
+bool TT::MappedFile::isOpen() const {
+	return data != NULL;
+}
+
+const void* TT::MappedFile::getData() const {
+	return data;
+}
+size_t TT::MappedFile::getSize() const {
+	return size;
+}
\ No newline at end of file
@@ -0,0 +1,22 @@
+#pragma once
+#include <cstddef>
+
+namespace TT {
+	// A read-only view of a whole file, paged in by the OS on first touch instead of read up front.
+	class MappedFile {
+	public:
+		MappedFile(const char* location);
+
+		void clear();
+
+		bool isOpen() const;
+
+		const void* getData() const;
+		size_t getSize() const;
+	private:
+		const void* data;
+		size_t size;
+
+		void* handle;
+	};
+}
\ No newline at end of file
@@ -1,7 +1,20 @@
+#include <cstring>
+#include <filesystem>
 #include "graphics.h"
+#include "threading.h"
+
+const static char* textureCacheLocation = "cache/textures/";
 
 GLFWwindow* TT::Window::window = nullptr;
 
+std::atomic<int> TT::Window::width = 0;
+std::atomic<int> TT::Window::height = 0;
+std::atomic<int> TT::Window::frameBufferWidth = 0;
+std::atomic<int> TT::Window::frameBufferHeight = 0;
+
+std::mutex TT::Window::imGuiMutex;
+double TT::Window::imGuiTime = 0.0;
+
 bool TT::Window::create(int width, int height, const char* title, bool resizable, bool verticalSync) {
 	if (!glfwInit()) {
 		std::cerr << "Poshel k cherty, glfw ne rabotaet!\n";
@@ -19,8 +32,22 @@ bool TT::Window::create(int width, int height, const char* title, bool resizable
 	}
 
 	glfwMakeContextCurrent(window);
-	glfwSetWindowSizeCallback(window, [](GLFWwindow* _window, int _width, int _height) {
-		glViewport(0, 0, _width, _height);
+
+	Window::width = width;
+	Window::height = height;
+	glfwSetWindowSizeCallback(window, [](GLFWwindow*, int _width, int _height) {
+		Window::width = _width;
+		Window::height = _height;
+	});
+
+	int _frameBufferWidth, _frameBufferHeight;
+	glfwGetFramebufferSize(window, &_frameBufferWidth, &_frameBufferHeight);
+
+	frameBufferWidth = _frameBufferWidth;
+	frameBufferHeight = _frameBufferHeight;
+	glfwSetFramebufferSizeCallback(window, [](GLFWwindow*, int _width, int _height) {
+		frameBufferWidth = _width;
+		frameBufferHeight = _height;
 	});
 
 	const GLFWvidmode* videoMode = glfwGetVideoMode(glfwGetPrimaryMonitor());
@@ -35,12 +62,14 @@ bool TT::Window::create(int width, int height, const char* title, bool resizable
 
 	return true;
 }
-void TT::Window::update() {
+void TT::Window::swapBuffers() {
 	glfwSwapBuffers(window);
-	glfwPollEvents();
-
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 }
+void TT::Window::pollEvents(double timeout) {
+	if (timeout > 0.0) glfwWaitEventsTimeout(timeout);
+	else glfwPollEvents();
+}
 void TT::Window::close() {
 	glfwDestroyWindow(window);
 	glfwTerminate();
@@ -59,12 +88,56 @@ void TT::Window::initializeImGui(unsigned int theme) {
 	else if (theme == TT_IMGUI_THEME_LIGHT) ImGui::StyleColorsLight();
 	else if (theme == TT_IMGUI_THEME_CLASSIC) ImGui::StyleColorsClassic();
 
-	ImGui_ImplGlfw_InitForOpenGL(window, true);
+	// The cursor is grabbed and released from the window thread, ImGui must not flip it back from the render thread.
+	ImGui::GetIO().ConfigFlags |= ImGuiConfigFlags_NoMouseCursorChange;
+
+	ImGui_ImplGlfw_InitForOpenGL(window, false);
 	ImGui_ImplOpenGL3_Init("#version 120");
+
+	// Events queue into ImGui while a frame may be under way on another thread.
+	glfwSetWindowFocusCallback(window, [](GLFWwindow* _window, int focused) {
+		std::lock_guard<std::mutex> lock(imGuiMutex);
+		ImGui_ImplGlfw_WindowFocusCallback(_window, focused);
+	});
+	glfwSetCursorEnterCallback(window, [](GLFWwindow* _window, int entered) {
+		std::lock_guard<std::mutex> lock(imGuiMutex);
+		ImGui_ImplGlfw_CursorEnterCallback(_window, entered);
+	});
+	glfwSetCursorPosCallback(window, [](GLFWwindow* _window, double x, double y) {
+		std::lock_guard<std::mutex> lock(imGuiMutex);
+		ImGui_ImplGlfw_CursorPosCallback(_window, x, y);
+	});
+	glfwSetMouseButtonCallback(window, [](GLFWwindow* _window, int button, int action, int mods) {
+		std::lock_guard<std::mutex> lock(imGuiMutex);
+		ImGui_ImplGlfw_MouseButtonCallback(_window, button, action, mods);
+	});
+	glfwSetScrollCallback(window, [](GLFWwindow* _window, double x, double y) {
+		std::lock_guard<std::mutex> lock(imGuiMutex);
+		ImGui_ImplGlfw_ScrollCallback(_window, x, y);
+	});
+	glfwSetKeyCallback(window, [](GLFWwindow* _window, int key, int scancode, int action, int mods) {
+		std::lock_guard<std::mutex> lock(imGuiMutex);
+		ImGui_ImplGlfw_KeyCallback(_window, key, scancode, action, mods);
+	});
+	glfwSetCharCallback(window, [](GLFWwindow* _window, unsigned int c) {
+		std::lock_guard<std::mutex> lock(imGuiMutex);
+		ImGui_ImplGlfw_CharCallback(_window, c);
+	});
 }
 void TT::Window::beginImGui() {
 	ImGui_ImplOpenGL3_NewFrame();
-	ImGui_ImplGlfw_NewFrame();
+
+	std::lock_guard<std::mutex> lock(imGuiMutex);
+
+	// Stands in for ImGui_ImplGlfw_NewFrame, which queries the window and cursor through calls reserved to the window thread.
+	// Focus, cursor and button state already arrive through the callbacks above.
+	ImGuiIO& io = ImGui::GetIO();
+	io.DisplaySize = ImVec2((float)width, (float)height);
+	if (width > 0 && height > 0) io.DisplayFramebufferScale = ImVec2((float)frameBufferWidth / width, (float)frameBufferHeight / height);
+
+	double time = glfwGetTime();
+	io.DeltaTime = imGuiTime > 0.0 ? (float)glm::max(time - imGuiTime, 0.00001) : 1.0f / 60.0f;
+	imGuiTime = time;
 
 	ImGui::NewFrame();
 }
@@ -84,10 +157,7 @@ bool TT::Window::isRunning() {
 }
 
 glm::vec2 TT::Window::getSize() {
-	int width = 0, height = 0;
-	glfwGetWindowSize(window, &width, &height);
-
-	return glm::vec2(width, height);
+	return glm::vec2((float)width, (float)height);
 }
 
 GLFWwindow* TT::Window::getId() {
@@ -146,21 +216,23 @@ bool TT::ShaderProgram::compile() const {
 		success = false;
 	}
 
-
+	return success;
+}
+bool TT::ShaderProgram::validate() const {
 	glValidateProgram(id);
 
-	int compiled = 0;
-	glGetProgramiv(id, GL_VALIDATE_STATUS, &compiled);
+	int validated = 0;
+	glGetProgramiv(id, GL_VALIDATE_STATUS, &validated);
 
-	if (!compiled) {
+	if (!validated) {
 		char log[512];
 		glGetProgramInfoLog(id, 512, NULL, log);
 
 		std::cerr << "Ne pravilno, dva!\nOshibka:\n" << log << '\n';
-		success = false;
+		return false;
 	}
 
-	return success;
+	return true;
 }
 
 void TT::ShaderProgram::load() const {
@@ -193,29 +265,45 @@ void TT::ShaderProgram::setUniform(const char* id, glm::vec3 value) const {
 void TT::ShaderProgram::setUniform(const char* id, glm::vec4 value) const {
 	glUniform4f(glGetUniformLocation(this->id, id), value.x, value.y, value.z, value.w);
 }
+void TT::ShaderProgram::setUniformBlock(const char* id, int binding) const {
+	GLuint index = glGetUniformBlockIndex(this->id, id);
+	if (index != GL_INVALID_INDEX) glUniformBlockBinding(this->id, index, binding);
+}
 
 void TT::FrameBuffer::unload() {
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 	glViewport(0, 0, (int)Window::getSize().x, (int)Window::getSize().y);
 }
 
-TT::FrameBuffer::FrameBuffer(int width, int height) {
+TT::FrameBuffer::FrameBuffer(int width, int height, GLint internalFormat, int attachments) : FrameBuffer(width, height, std::vector<GLint>(attachments, internalFormat)) {}
+TT::FrameBuffer::FrameBuffer(int width, int height, const std::vector<GLint>& internalFormats) {
+	int attachments = (int)internalFormats.size();
+
 	this->width = width;
 	this->height = height;
 
 	glGenFramebuffers(1, &fboId);
 	glBindFramebuffer(GL_FRAMEBUFFER, fboId);
 
-	glGenTextures(1, &textureId);
-	glBindTexture(GL_TEXTURE_2D, textureId);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_FLOAT, NULL);
+	textureIds.resize(attachments);
+	glGenTextures(attachments, textureIds.data());
 
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	std::vector<GLenum> drawBuffers;
+	for (int i = 0; i < attachments; i++) {
+		glBindTexture(GL_TEXTURE_2D, textureIds[i]);
+		glTexImage2D(GL_TEXTURE_2D, 0, internalFormats[i], width, height, 0, GL_RGBA, GL_FLOAT, NULL);
 
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textureId, 0);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, textureIds[i], 0);
+		drawBuffers.push_back(GL_COLOR_ATTACHMENT0 + i);
+	}
+
+	glDrawBuffers(attachments, drawBuffers.data());
+	glBindTexture(GL_TEXTURE_2D, 0);
 
 	unload();
 }
@@ -228,11 +316,27 @@ void TT::FrameBuffer::load() const {
 }
 void TT::FrameBuffer::clear() const {
 	glDeleteFramebuffers(1, &fboId);
-	glDeleteTextures(1, &textureId);
+	glDeleteTextures((GLsizei)textureIds.size(), textureIds.data());
 }
 
-int TT::FrameBuffer::getTexture() const {
-	return textureId;
+std::vector<glm::vec4> TT::FrameBuffer::readPixels(int attachment) const {
+	std::vector<glm::vec4> pixels(width * height);
+
+	glBindTexture(GL_TEXTURE_2D, textureIds[attachment]);
+	glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_FLOAT, pixels.data());
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	return pixels;
+}
+
+void TT::FrameBuffer::generateMipmaps(int attachment) const {
+	glBindTexture(GL_TEXTURE_2D, textureIds[attachment]);
+	glGenerateMipmap(GL_TEXTURE_2D);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+int TT::FrameBuffer::getTexture(int attachment) const {
+	return textureIds[attachment];
 }
 int TT::FrameBuffer::getWidth() const {
 	return width;
@@ -241,37 +345,280 @@ int TT::FrameBuffer::getHeight() const {
 	return height;
 }
 
-int TT::Texture::loadFromFile(const char* location, GLint filter) {
-	stbi_set_flip_vertically_on_load(true);
+TT::GpuTimer::GpuTimer() {
+	glGenQueries(queryCount, queryIds);
 
-	int width, height, channels;
-	unsigned char* image = stbi_load(location, &width, &height, &channels, 0);
+	for (int i = 0; i < queryCount; i++) pending[i] = false;
+	current = 0;
+	warmedUp = false;
+
+	time = 0.0f;
+	timestamp = 0.0;
+}
 
-	if (!image) std::cerr << "Could not open image: \"" << location << '\"';
+void TT::GpuTimer::begin(double timestamp) {
+	// The oldest query is reused, its result is taken first if the GPU has finished it, otherwise that frame is dropped.
+	if (pending[current]) {
+		GLint available = 0;
+		glGetQueryObjectiv(queryIds[current], GL_QUERY_RESULT_AVAILABLE, &available);
+
+		if (available) {
+			GLuint64 elapsed = 0;
+			glGetQueryObjectui64v(queryIds[current], GL_QUERY_RESULT, &elapsed);
+
+			// The first frame carries shader compilation, and Mesa's llvmpipe reports the time since boot for it.
+			if (warmedUp) {
+				time = (float)(elapsed / 1000000.0);
+				this->timestamp = timestamps[current];
+			}
+			warmedUp = true;
+		}
+	}
+
+	timestamps[current] = timestamp;
+	glBeginQuery(GL_TIME_ELAPSED, queryIds[current]);
+}
+void TT::GpuTimer::end() {
+	glEndQuery(GL_TIME_ELAPSED);
+
+	pending[current] = true;
+	current = (current + 1) % queryCount;
+}
+void TT::GpuTimer::clear() const {
+	glDeleteQueries(queryCount, queryIds);
+}
+
+float TT::GpuTimer::getTime() const {
+	return time;
+}
+double TT::GpuTimer::getTimestamp() const {
+	return timestamp;
+}
+
+TT::UniformBuffer::UniformBuffer(size_t size) : size(size), mapped(NULL), current(0) {
+	GLint alignment = 256;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+
+	stride = (size + alignment - 1) / alignment * alignment;
+	for (int i = 0; i < slotCount; i++) fences[i] = NULL;
+
+	glGenBuffers(1, &bufferId);
+	glBindBuffer(GL_UNIFORM_BUFFER, bufferId);
+
+	if (GLEW_ARB_buffer_storage) {
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+		// Dynamic storage keeps the glBufferSubData path open should mapping fail.
+		glBufferStorage(GL_UNIFORM_BUFFER, stride * slotCount, NULL, flags | GL_DYNAMIC_STORAGE_BIT);
+		mapped = (unsigned char*)glMapBufferRange(GL_UNIFORM_BUFFER, 0, stride * slotCount, flags);
+	}
+	else glBufferData(GL_UNIFORM_BUFFER, stride * slotCount, NULL, GL_STREAM_DRAW);
+
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void TT::UniformBuffer::update(const void* data, int binding) {
+	if (mapped) {
+		// Everything submitted since the last update may read the current region, the fence lands after all of it.
+		fences[current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		current = (current + 1) % slotCount;
+
+		if (fences[current]) {
+			glClientWaitSync(fences[current], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+			glDeleteSync(fences[current]);
+
+			fences[current] = NULL;
+		}
+
+		memcpy(mapped + current * stride, data, size);
+	}
+	else {
+		current = (current + 1) % slotCount;
+
+		glBindBuffer(GL_UNIFORM_BUFFER, bufferId);
+		glBufferSubData(GL_UNIFORM_BUFFER, current * stride, size, data);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+
+	glBindBufferRange(GL_UNIFORM_BUFFER, binding, bufferId, current * stride, size);
+}
+void TT::UniformBuffer::clear() {
+	for (int i = 0; i < slotCount; i++)
+		if (fences[i]) glDeleteSync(fences[i]);
+
+	if (mapped) {
+		glBindBuffer(GL_UNIFORM_BUFFER, bufferId);
+		glUnmapBuffer(GL_UNIFORM_BUFFER);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+
+	glDeleteBuffers(1, &bufferId);
+}
+
+bool TT::UniformBuffer::isPersistent() const {
+	return mapped != NULL;
+}
+
+TT::BufferTexture::BufferTexture(const void* data, size_t size, GLenum format) {
+	glGenBuffers(1, &bufferId);
+	glBindBuffer(GL_TEXTURE_BUFFER, bufferId);
+	glBufferData(GL_TEXTURE_BUFFER, size, data, GL_STATIC_DRAW);
 
-	GLuint textureId;
 	glGenTextures(1, &textureId);
-	glBindTexture(GL_TEXTURE_2D, textureId);
+	glBindTexture(GL_TEXTURE_BUFFER, textureId);
+	glTexBuffer(GL_TEXTURE_BUFFER, format, bufferId);
 
-	GLint format = GL_RGBA;
-	if (channels == 3) format = GL_RGB;
-	if (channels == 2) format = GL_RG;
-	if (channels == 1) format = GL_R;
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+void TT::BufferTexture::load(int id) const {
+	glActiveTexture(GL_TEXTURE0 + id);
+	glBindTexture(GL_TEXTURE_BUFFER, textureId);
+}
+void TT::BufferTexture::clear() const {
+	glDeleteTextures(1, &textureId);
+	glDeleteBuffers(1, &bufferId);
+}
 
-	glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, image);
+int TT::BufferTexture::getTexture() const {
+	return textureId;
+}
+
+std::vector<std::shared_ptr<TT::Texture::Request>> TT::Texture::requests;
+
+GLuint TT::Texture::stagingBuffer = 0;
+unsigned char* TT::Texture::staging = NULL;
+size_t TT::Texture::stagingHead = 0;
+std::vector<std::shared_ptr<TT::Texture::Request>> TT::Texture::stagingRequests;
+
+TT::Texture::Request::~Request() {
+	if (!cache) return;
+
+	cache->clear();
+	delete cache;
+}
+
+int TT::Texture::loadFromFile(const char* location, GLint filter) {
+	Request request;
+	request.location = location;
+	request.filter = filter;
 
+	decode(request);
+
+	GLuint textureId;
+	glGenTextures(1, &textureId);
+	request.texture = textureId;
+
+	upload(request, (uintptr_t)request.pixels);
+
+	glBindTexture(GL_TEXTURE_2D, textureId);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, getMagFilter(filter));
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glBindTexture(GL_TEXTURE_2D, 0);
 
+	return textureId;
+}
+int TT::Texture::loadFromFileAsync(const char* location, GLint filter, glm::vec4 placeholder) {
+	unsigned char color[4];
+	for (int i = 0; i < 4; i++) color[i] = (unsigned char)(glm::clamp(placeholder[i], 0.0f, 1.0f) * 255.0f + 0.5f);
+
+	GLuint textureId;
+	glGenTextures(1, &textureId);
+
+	setImage(textureId, 0, 1, 1, 4, color);
+
+	// The placeholder has no mip levels, so sampling stays linear until the image arrives.
+	glBindTexture(GL_TEXTURE_2D, textureId);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, getMagFilter(filter));
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
 	glBindTexture(GL_TEXTURE_2D, 0);
 
-	stbi_image_free(image);
+	std::shared_ptr<Request> request = std::make_shared<Request>();
+	request->texture = textureId;
+	request->filter = filter;
+	request->location = location;
+
+	requests.push_back(request);
+
+	// The job keeps its own reference, so clearing the texture early only drops the result.
+	ThreadPool::submit([request]() {
+		decode(*request);
+		request->ready = true;
+	});
 
 	return textureId;
 }
 
+bool TT::Texture::update() {
+	reclaimStaging();
+
+	for (size_t i = 0; i < requests.size(); i++) {
+		std::shared_ptr<Request> request = requests[i];
+		if (!request->ready) continue;
+
+		// Images that failed to decode keep their placeholder.
+		if (!request->pixels) {
+			requests.erase(requests.begin() + i);
+			return false;
+		}
+
+		size_t size = getUploadSize(*request);
+
+		// Images that fit the ring wait for space in it rather than being copied here.
+		if (!request->reserved && size <= stagingSize && reserveStaging(request, size)) continue;
+		if (request->reserved && !request->staged) continue;
+		if (!request->reserved && size <= stagingSize && staging) continue;
+
+		requests.erase(requests.begin() + i);
+
+		GLuint bufferId = stagingBuffer;
+		bool uploaded = true;
+
+		if (request->reserved) {
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, stagingBuffer);
+			upload(*request, request->stagingOffset);
+
+			request->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		}
+		else {
+			glGenBuffers(1, &bufferId);
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, bufferId);
+			glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+
+			void* pixels = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+			uploaded = pixels != NULL;
+
+			if (uploaded) {
+				memcpy(pixels, request->pixels, size);
+				glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+				upload(*request, 0);
+			}
+		}
+
+		if (uploaded) {
+			glBindTexture(GL_TEXTURE_2D, request->texture);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, request->filter);
+			glBindTexture(GL_TEXTURE_2D, 0);
+		}
+
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		if (bufferId != stagingBuffer) glDeleteBuffers(1, &bufferId);
+
+		return uploaded;
+	}
+
+	return false;
+}
+bool TT::Texture::isLoading() {
+	return !requests.empty();
+}
+
 void TT::Texture::load(GLuint texture, int id) {
 	glActiveTexture(GL_TEXTURE0 + id);
 	glBindTexture(GL_TEXTURE_2D, texture);
@@ -280,5 +627,321 @@ void TT::Texture::unload() {
 	glBindTexture(GL_TEXTURE_2D, 0);
 }
 void TT::Texture::clear(GLuint texture) {
+	for (size_t i = 0; i < requests.size(); i++) {
+		if (requests[i]->texture != texture) continue;
+
+		// Ring space is given back once the copy job is done with it.
+		requests[i]->dropped = true;
+		requests.erase(requests.begin() + i);
+		break;
+	}
+
 	glDeleteTextures(1, &texture);
+}
+
+void TT::Texture::decode(Request& request) {
+	MappedFile source(request.location.c_str());
+	if (!source.isOpen()) {
+		std::cerr << "Could not open image: \"" << request.location << '\"';
+		return;
+	}
+
+	// FNV-1a over the encoded file, hashing is a small fraction of decoding it.
+	const unsigned char* bytes = (const unsigned char*)source.getData();
+
+	uint64_t sourceHash = 14695981039346656037ull;
+	for (size_t i = 0; i < source.getSize(); i++) sourceHash = (sourceHash ^ bytes[i]) * 1099511628211ull;
+
+	char name[17];
+	snprintf(name, sizeof(name), "%016llx", (unsigned long long)sourceHash);
+	std::string cacheLocation = std::string(textureCacheLocation) + name + ".rttex";
+
+	if (loadCache(request, cacheLocation, sourceHash)) {
+		source.clear();
+		return;
+	}
+
+	stbi_set_flip_vertically_on_load_thread(true);
+	unsigned char* image = stbi_load_from_memory(bytes, (int)source.getSize(), &request.width, &request.height, &request.channels, 0);
+	source.clear();
+
+	if (!image) {
+		std::cerr << "Could not open image: \"" << request.location << '\"';
+		return;
+	}
+
+	request.levels = 1;
+	while (glm::max(request.width, request.height) >> request.levels) request.levels++;
+
+	size_t size = 0;
+	for (int level = 0; level < request.levels; level++) size += getLevelSize(request, level);
+
+	request.decoded.resize(size);
+	memcpy(request.decoded.data(), image, getLevelSize(request, 0));
+	stbi_image_free(image);
+
+	// Box filtered mip chain, odd edges fold their last row or column into the one before.
+	unsigned char* parent = request.decoded.data();
+	for (int level = 1; level < request.levels; level++) {
+		int parentWidth = glm::max(request.width >> (level - 1), 1), parentHeight = glm::max(request.height >> (level - 1), 1);
+		int width = glm::max(request.width >> level, 1), height = glm::max(request.height >> level, 1);
+
+		unsigned char* target = parent + getLevelSize(request, level - 1);
+
+		for (int y = 0; y < height; y++) {
+			for (int x = 0; x < width; x++) {
+				int x0 = glm::min(x * 2, parentWidth - 1), x1 = glm::min(x * 2 + 1, parentWidth - 1);
+				int y0 = glm::min(y * 2, parentHeight - 1), y1 = glm::min(y * 2 + 1, parentHeight - 1);
+
+				for (int channel = 0; channel < request.channels; channel++) {
+					int sum = parent[(y0 * parentWidth + x0) * request.channels + channel] + parent[(y0 * parentWidth + x1) * request.channels + channel]
+						+ parent[(y1 * parentWidth + x0) * request.channels + channel] + parent[(y1 * parentWidth + x1) * request.channels + channel];
+
+					// Ties round up and down in a checkerboard, always rounding up brightens the small levels.
+					target[(y * width + x) * request.channels + channel] = (unsigned char)((sum + 1 + ((x + y) & 1)) / 4);
+				}
+			}
+		}
+
+		parent = target;
+	}
+
+	request.pixels = request.decoded.data();
+	saveCache(request, cacheLocation, sourceHash);
+}
+bool TT::Texture::loadCache(Request& request, const std::string& location, uint64_t sourceHash) {
+	MappedFile* cache = new MappedFile(location.c_str());
+
+	const CacheHeader* header = (const CacheHeader*)cache->getData();
+	if (cache->isOpen() && cache->getSize() >= sizeof(CacheHeader) && memcmp(header->magic, "RTTX", 4) == 0
+		&& header->version == cacheVersion && header->sourceHash == sourceHash) {
+		request.width = header->width;
+		request.height = header->height;
+		request.channels = header->channels;
+		request.levels = header->levels;
+
+		size_t size = 0;
+		for (int level = 0; level < request.levels; level++) size += getLevelSize(request, level);
+
+		if (cache->getSize() == sizeof(CacheHeader) + size) {
+			request.cache = cache;
+			request.pixels = (const unsigned char*)cache->getData() + sizeof(CacheHeader);
+
+			return true;
+		}
+	}
+
+	cache->clear();
+	delete cache;
+
+	return false;
+}
+void TT::Texture::saveCache(const Request& request, const std::string& location, uint64_t sourceHash) {
+	CacheHeader header = { { 'R', 'T', 'T', 'X' }, cacheVersion, sourceHash, request.width, request.height, request.channels, request.levels };
+
+	std::error_code error;
+	std::filesystem::create_directories(textureCacheLocation, error);
+
+	// Written aside and renamed, a second loader of the same image never maps a half written file.
+	std::string temporaryLocation = location + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+	{
+		std::ofstream file(temporaryLocation, std::ios::binary);
+		file.write((const char*)&header, sizeof(header));
+		file.write((const char*)request.decoded.data(), request.decoded.size());
+
+		if (!file) {
+			std::cerr << "Could not write texture cache: \"" << location << "\"\n";
+			return;
+		}
+	}
+
+	std::filesystem::rename(temporaryLocation, location, error);
+	if (error) std::filesystem::remove(temporaryLocation, error);
+}
+
+bool TT::Texture::reserveStaging(const std::shared_ptr<Request>& request, size_t size) {
+	if (!staging) {
+		if (!GLEW_ARB_buffer_storage) return false;
+
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+		glGenBuffers(1, &stagingBuffer);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, stagingBuffer);
+		glBufferStorage(GL_PIXEL_UNPACK_BUFFER, stagingSize, NULL, flags);
+		staging = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, stagingSize, flags);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+		if (!staging) {
+			clearStaging();
+			return false;
+		}
+	}
+
+	// Space in use runs from the oldest reservation up to the head, wrapping around the end of the ring.
+	size_t offset;
+	if (stagingRequests.empty()) offset = 0;
+	else {
+		size_t tail = stagingRequests.front()->stagingOffset;
+
+		if (stagingHead > tail && stagingHead + size <= stagingSize) offset = stagingHead;
+		else if (stagingHead > tail && size < tail) offset = 0;
+		else if (stagingHead < tail && stagingHead + size < tail) offset = stagingHead;
+		else return false;
+	}
+
+	request->stagingOffset = offset;
+	request->reserved = true;
+
+	stagingHead = offset + size;
+	stagingRequests.push_back(request);
+
+	unsigned char* target = staging + offset;
+	ThreadPool::submit([request, target, size]() {
+		memcpy(target, request->pixels, size);
+		request->staged = true;
+	});
+
+	return true;
+}
+void TT::Texture::reclaimStaging() {
+	while (!stagingRequests.empty()) {
+		Request& request = *stagingRequests.front();
+
+		if (request.fence) {
+			if (glClientWaitSync(request.fence, 0, 0) == GL_TIMEOUT_EXPIRED) break;
+
+			glDeleteSync(request.fence);
+			request.fence = NULL;
+		}
+		else if (!request.dropped || !request.staged) break;
+
+		stagingRequests.erase(stagingRequests.begin());
+	}
+
+	// The ring only lives while images are arriving.
+	if (staging && stagingRequests.empty() && requests.empty()) clearStaging();
+}
+void TT::Texture::clearStaging() {
+	if (staging) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, stagingBuffer);
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	}
+
+	glDeleteBuffers(1, &stagingBuffer);
+
+	stagingBuffer = 0;
+	staging = NULL;
+	stagingHead = 0;
+}
+
+void TT::Texture::upload(const Request& request, uintptr_t pixels) {
+	int levels = getUploadLevels(request);
+
+	size_t offset = 0;
+	for (int level = 0; level < levels; level++) {
+		setImage(request.texture, level, glm::max(request.width >> level, 1), glm::max(request.height >> level, 1), request.channels, reinterpret_cast<const void*>(pixels + offset));
+		offset += getLevelSize(request, level);
+	}
+
+	glBindTexture(GL_TEXTURE_2D, request.texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+void TT::Texture::setImage(GLuint texture, int level, int width, int height, int channels, const void* pixels) {
+	GLint format = GL_RGBA;
+	if (channels == 3) format = GL_RGB;
+	if (channels == 2) format = GL_RG;
+	if (channels == 1) format = GL_RED;
+
+	// Rows of three channel images are rarely a multiple of four bytes.
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexImage2D(GL_TEXTURE_2D, level, format, width, height, 0, format, GL_UNSIGNED_BYTE, pixels);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+GLint TT::Texture::getMagFilter(GLint filter) {
+	// Magnification never reads lower levels, so mipmapped filters fall back to their base filter.
+	if (filter == GL_NEAREST_MIPMAP_NEAREST || filter == GL_NEAREST_MIPMAP_LINEAR) return GL_NEAREST;
+	if (filter == GL_LINEAR_MIPMAP_NEAREST || filter == GL_LINEAR_MIPMAP_LINEAR) return GL_LINEAR;
+
+	return filter;
+}
+int TT::Texture::getUploadLevels(const Request& request) {
+	// Lower levels only matter to mipmapped filters, the ray tracer samples at hit points where no footprint is known.
+	bool mipmapped = request.filter != GL_LINEAR && request.filter != GL_NEAREST;
+	return mipmapped ? glm::max(request.levels, 1) : 1;
+}
+size_t TT::Texture::getLevelSize(const Request& request, int level) {
+	return (size_t)glm::max(request.width >> level, 1) * glm::max(request.height >> level, 1) * request.channels;
+}
+size_t TT::Texture::getUploadSize(const Request& request) {
+	size_t size = 0;
+	for (int level = 0; level < getUploadLevels(request); level++) size += getLevelSize(request, level);
+
+	return size;
+}
+
+TT::Image::Image(glm::vec4 fallback) : width(0), height(0), channels(0), fallback(fallback) {}
+
+bool TT::Image::loadFromFile(const char* location) {
+	stbi_set_flip_vertically_on_load_thread(true);
+
+	unsigned char* image = stbi_load(location, &width, &height, &channels, 0);
+	if (!image) {
+		std::cerr << "Could not open image: \"" << location << '\"';
+
+		width = 0;
+		height = 0;
+		pixels.clear();
+
+		return false;
+	}
+
+	pixels.assign(image, image + width * height * channels);
+	stbi_image_free(image);
+
+	return true;
+}
+glm::vec4 TT::Image::sample(glm::vec2 uv) const {
+	if (pixels.empty()) return fallback;
+
+	// Same lookup as GL_LINEAR + GL_REPEAT, texel centers sit at half-integer coordinates.
+	float x = uv.x * width - 0.5f;
+	float y = uv.y * height - 0.5f;
+
+	int x0 = (int)floor(x);
+	int y0 = (int)floor(y);
+
+	float fx = x - x0;
+	float fy = y - y0;
+
+	glm::vec4 bottom = glm::mix(getTexel(x0, y0), getTexel(x0 + 1, y0), fx);
+	glm::vec4 top = glm::mix(getTexel(x0, y0 + 1), getTexel(x0 + 1, y0 + 1), fx);
+
+	return glm::mix(bottom, top, fy);
+}
+
+int TT::Image::getWidth() const {
+	return width;
+}
+int TT::Image::getHeight() const {
+	return height;
+}
+
+glm::vec4 TT::Image::getTexel(int x, int y) const {
+	x %= width;
+	y %= height;
+	if (x < 0) x += width;
+	if (y < 0) y += height;
+
+	const unsigned char* texel = &pixels[(y * width + x) * channels];
+
+	glm::vec4 color(0.0f, 0.0f, 0.0f, 1.0f);
+	for (int i = 0; i < channels; i++) color[i] = texel[i] / 255.0f;
+
+	return color;
 }
\ No newline at end of file
@@ -2,9 +2,13 @@
 #include <GLEW/glew.h>
 #include <GLFW/glfw3.h>
 #include <GLM/glm.hpp>
+#include <atomic>
+#include <cstdint>
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <memory>
+#include <mutex>
 #include <vector>
 #include <string>
 #include <fstream>
@@ -13,16 +17,20 @@
 #include "../imgui/imgui_impl_glfw.h"
 #include "../imgui/imgui_impl_opengl3.h"
 #include "../stb/stb_image.h"
+#include "files.h"
 
 #define TT_IMGUI_THEME_DARK 0
 #define TT_IMGUI_THEME_LIGHT 1
 #define TT_IMGUI_THEME_CLASSIC 2
 
 namespace TT {
+	// Events and input belong to the thread that created the window, swapping and ImGui may run on the thread
+	// holding the context. ImGui input callbacks and frames are serialized so the two can run at once.
 	class Window {
 	public:
 		static bool create(int width, int height, const char* title, bool resizable, bool verticalSync);
-		static void update();
+		static void swapBuffers();
+		static void pollEvents(double timeout = 0.0);
 		static void close();
 
 		static void initializeImGui(unsigned int theme);
@@ -38,6 +46,13 @@ namespace TT {
 		static GLFWwindow* getId();
 	private:
 		static GLFWwindow* window;
+
+		// Kept from the size callbacks, glfwGetWindowSize and glfwGetFramebufferSize may only be called from the window thread.
+		static std::atomic<int> width, height;
+		static std::atomic<int> frameBufferWidth, frameBufferHeight;
+
+		static std::mutex imGuiMutex;
+		static double imGuiTime;
 	};
 
 	class Shader {
@@ -55,6 +70,7 @@ namespace TT {
 		
 		void addShader(Shader shader);
 		bool compile() const;
+		bool validate() const;
 
 		void load() const;
 		static void unload();
@@ -66,32 +82,178 @@ namespace TT {
 		void setUniform(const char* id, glm::vec2 value) const;
 		void setUniform(const char* id, glm::vec3 value) const;
 		void setUniform(const char* id, glm::vec4 value) const;
+		void setUniformBlock(const char* id, int binding) const;
 	private:
 		int id;
 		std::vector<Shader> shaders;
 	};
 	class FrameBuffer {
 	public:
-		FrameBuffer(int width, int height);
+		FrameBuffer(int width, int height, GLint internalFormat = GL_RGBA, int attachments = 1);
+		// One internal format per attachment.
+		FrameBuffer(int width, int height, const std::vector<GLint>& internalFormats);
 
 		void load() const;
 		void clear() const;
 
 		static void unload();
 
-		int getTexture() const;
+		std::vector<glm::vec4> readPixels(int attachment = 0) const;
+		void generateMipmaps(int attachment = 0) const;
+
+		int getTexture(int attachment = 0) const;
 		int getWidth() const;
 		int getHeight() const;
 	private:
-		GLuint fboId, rboId, textureId;
+		GLuint fboId, rboId;
+		std::vector<GLuint> textureIds;
 		int width, height;
 	};
+	// GL_TIME_ELAPSED queries kept in a ring, so reading a result never waits on frames still in flight.
+	// The timestamp given to begin is handed back with the matching result.
+	class GpuTimer {
+	public:
+		GpuTimer();
+
+		void begin(double timestamp = 0.0);
+		void end();
+		void clear() const;
+
+		float getTime() const;
+		double getTimestamp() const;
+	private:
+		static const int queryCount = 3;
+
+		GLuint queryIds[queryCount];
+		double timestamps[queryCount];
+		bool pending[queryCount];
+		int current;
+
+		bool warmedUp;
+		float time;
+		double timestamp;
+	};
+	// A small uniform block rewritten every frame. Where ARB_buffer_storage is available it stays persistently mapped and
+	// cycles through slotCount regions, each fenced until the GPU has read it, so a write right before a draw neither
+	// stalls nor touches data still in flight. Older contexts fall back to glBufferSubData.
+	class UniformBuffer {
+	public:
+		UniformBuffer(size_t size);
+
+		// Writes size bytes to the next region and binds it.
+		void update(const void* data, int binding);
+		void clear();
+
+		bool isPersistent() const;
+	private:
+		static const int slotCount = 3;
+
+		GLuint bufferId;
+		size_t size, stride;
+
+		unsigned char* mapped;
+		GLsync fences[slotCount];
+		int current;
+	};
+	class BufferTexture {
+	public:
+		BufferTexture(const void* data, size_t size, GLenum format);
+
+		void load(int id) const;
+		void clear() const;
+
+		int getTexture() const;
+	private:
+		GLuint bufferId, textureId;
+	};
 	class Texture {
 	public:
 		static int loadFromFile(const char* location, GLint filter);
+		// Returns at once with a 1x1 placeholder, the image is decoded on the thread pool and swapped in by update.
+		static int loadFromFileAsync(const char* location, GLint filter, glm::vec4 placeholder);
+
+		// Uploads at most one decoded image per call through a pixel buffer, returns whether one was swapped in.
+		// Decoded images are copied into a persistently mapped staging ring on the thread pool, this thread only issues the upload.
+		static bool update();
+		static bool isLoading();
 		
 		static void load(GLuint texture, int id);
 		static void unload();
 		static void clear(GLuint texture);
+	private:
+		struct Request {
+			GLuint texture;
+			GLint filter;
+			std::string location;
+
+			int width = 0, height = 0, channels = 0, levels = 0;
+			const unsigned char* pixels = NULL;
+
+			// The texels live in one of these, depending on whether the cache had them.
+			std::vector<unsigned char> decoded;
+			MappedFile* cache = NULL;
+
+			std::atomic<bool> ready = false;
+
+			// Ring space taken for the copy, the fence is set once the upload that reads it was submitted.
+			size_t stagingOffset = 0;
+			bool reserved = false, dropped = false;
+			std::atomic<bool> staged = false;
+			GLsync fence = NULL;
+
+			~Request();
+		};
+		// Decoded texels with their whole mip chain, stored under the hash of the source file.
+		struct CacheHeader {
+			char magic[4];
+			uint32_t version;
+			uint64_t sourceHash;
+
+			int32_t width, height, channels, levels;
+		};
+
+		static const uint32_t cacheVersion = 1;
+		static std::vector<std::shared_ptr<Request>> requests;
+
+		// Large enough for a 4K RGB image, bigger ones are copied on this thread.
+		static const size_t stagingSize = 32 << 20;
+		static GLuint stagingBuffer;
+		static unsigned char* staging;
+		static size_t stagingHead;
+		// Requests holding ring space, in the order it was taken.
+		static std::vector<std::shared_ptr<Request>> stagingRequests;
+
+		static void decode(Request& request);
+		static bool loadCache(Request& request, const std::string& location, uint64_t sourceHash);
+		static void saveCache(const Request& request, const std::string& location, uint64_t sourceHash);
+
+		static bool reserveStaging(const std::shared_ptr<Request>& request, size_t size);
+		static void reclaimStaging();
+		static void clearStaging();
+
+		// Pixels is either a client pointer or an offset into the bound pixel unpack buffer.
+		static void upload(const Request& request, uintptr_t pixels);
+		static void setImage(GLuint texture, int level, int width, int height, int channels, const void* pixels);
+		static GLint getMagFilter(GLint filter);
+		static int getUploadLevels(const Request& request);
+		static size_t getLevelSize(const Request& request, int level);
+		static size_t getUploadSize(const Request& request);
+	};
+	class Image {
+	public:
+		Image(glm::vec4 fallback);
+
+		bool loadFromFile(const char* location);
+		glm::vec4 sample(glm::vec2 uv) const;
+
+		int getWidth() const;
+		int getHeight() const;
+	private:
+		int width, height, channels;
+		std::vector<unsigned char> pixels;
+
+		glm::vec4 fallback;
+
+		glm::vec4 getTexel(int x, int y) const;
 	};
 }
\ No newline at end of file
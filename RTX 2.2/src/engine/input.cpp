@@ -3,7 +3,16 @@
 glm::vec2 TT::Mouse::velocity;
 glm::vec2 TT::Mouse::lastPosition;
 
+std::vector<int> TT::InputLog::keys;
+std::vector<TT::InputLog::Frame> TT::InputLog::frames;
+std::ofstream TT::InputLog::file;
+
+int TT::InputLog::frame = -1;
+bool TT::InputLog::recording = false;
+bool TT::InputLog::replaying = false;
+
 bool TT::Keyboard::isPressed(int key) {
+	if (InputLog::isReplaying()) return InputLog::isKeyPressed(key);
 	return glfwGetKey(TT::Window::getId(), key) == GLFW_PRESS;
 }
 
@@ -22,6 +31,7 @@ void TT::Mouse::setGrabbed(bool grabbed) {
 }
 
 bool TT::Mouse::isGrabbed() {
+	if (InputLog::isReplaying()) return InputLog::isMouseGrabbed();
 	return glfwGetInputMode(TT::Window::getId(), GLFW_CURSOR) == GLFW_CURSOR_DISABLED;
 }
 bool TT::Mouse::isPressed(int button) {
@@ -29,6 +39,7 @@ bool TT::Mouse::isPressed(int button) {
 }
 
 glm::vec2 TT::Mouse::getVelocity() {
+	if (InputLog::isReplaying()) return InputLog::getMouseVelocity();
 	return glm::vec2(velocity);
 }
 glm::vec2 TT::Mouse::getPosition() {
@@ -36,4 +47,108 @@ glm::vec2 TT::Mouse::getPosition() {
 	glfwGetCursorPos(TT::Window::getId(), &x, &y);
 
 	return glm::vec2((float)x, (float)y);
+}
+
+bool TT::InputLog::startRecording(const char* location, const std::vector<int>& keys) {
+	stop();
+
+	if (keys.size() > 31) {
+		std::cerr << "Input logs hold at most 31 keys\n";
+		return false;
+	}
+
+	file.open(location, std::ios::binary);
+	if (!file) {
+		std::cerr << "Could not write input log: \"" << location << "\"\n";
+		return false;
+	}
+
+	uint32_t keyCount = (uint32_t)keys.size();
+
+	file.write("RTXI", 4);
+	file.write((const char*)&keyCount, sizeof(keyCount));
+	file.write((const char*)keys.data(), keys.size() * sizeof(int));
+
+	InputLog::keys = keys;
+	recording = true;
+
+	return true;
+}
+bool TT::InputLog::startReplay(const char* location) {
+	stop();
+
+	std::ifstream input(location, std::ios::binary);
+
+	char magic[4] = {};
+	uint32_t keyCount = 0;
+
+	input.read(magic, 4);
+	input.read((char*)&keyCount, sizeof(keyCount));
+
+	if (!input || std::string(magic, 4) != "RTXI" || keyCount > 31) {
+		std::cerr << "Could not read input log: \"" << location << "\"\n";
+		return false;
+	}
+
+	keys.resize(keyCount);
+	input.read((char*)keys.data(), keyCount * sizeof(int));
+
+	Frame logFrame;
+	while (input.read((char*)&logFrame, sizeof(Frame))) frames.push_back(logFrame);
+
+	frame = -1;
+	replaying = true;
+
+	return true;
+}
+void TT::InputLog::stop() {
+	if (file.is_open()) file.close();
+
+	keys.clear();
+	frames.clear();
+
+	frame = -1;
+	recording = false;
+	replaying = false;
+}
+
+void TT::InputLog::update(Time& time) {
+	if (recording) {
+		Frame logFrame = { Mouse::isGrabbed() ? grabbedBit : 0u, Mouse::getVelocity(), time.getDelta() };
+		for (size_t i = 0; i < keys.size(); i++)
+			if (Keyboard::isPressed(keys[i])) logFrame.keys |= 1u << i;
+
+		file.write((const char*)&logFrame, sizeof(Frame));
+	}
+	else if (replaying && !isFinished()) {
+		frame++;
+		if (!isFinished()) time.setDelta(frames[frame].delta);
+	}
+}
+
+bool TT::InputLog::isRecording() {
+	return recording;
+}
+bool TT::InputLog::isReplaying() {
+	return replaying;
+}
+bool TT::InputLog::isFinished() {
+	return replaying && frame >= (int)frames.size();
+}
+
+bool TT::InputLog::isKeyPressed(int key) {
+	if (frame < 0 || isFinished()) return false;
+
+	for (size_t i = 0; i < keys.size(); i++)
+		if (keys[i] == key) return (frames[frame].keys & (1u << i)) != 0;
+
+	return false;
+}
+bool TT::InputLog::isMouseGrabbed() {
+	if (frame < 0 || isFinished()) return false;
+	return (frames[frame].keys & grabbedBit) != 0;
+}
+glm::vec2 TT::InputLog::getMouseVelocity() {
+	if (frame < 0 || isFinished()) return glm::vec2(0.0f);
+	return frames[frame].mouseVelocity;
 }
\ No newline at end of file
@@ -1,5 +1,7 @@
 #pragma once
+#include <cstdint>
 #include "graphics.h"
+#include "math.h"
 
 namespace TT {
 	class Keyboard {
@@ -22,4 +24,39 @@ namespace TT {
 		static glm::vec2 velocity;
 		static glm::vec2 lastPosition;
 	};
+
+	// Writes the keys, mouse movement and time step every frame consumes to a binary log, or feeds a log back
+	// through Keyboard, Mouse and Time so a session replays with the same steps on any machine.
+	class InputLog {
+	public:
+		static bool startRecording(const char* location, const std::vector<int>& keys);
+		static bool startReplay(const char* location);
+		static void stop();
+
+		static void update(Time& time);
+
+		static bool isRecording();
+		static bool isReplaying();
+		static bool isFinished();
+
+		static bool isKeyPressed(int key);
+		static bool isMouseGrabbed();
+		static glm::vec2 getMouseVelocity();
+	private:
+		// Bit i of keys is the i-th logged key, the top bit is whether the mouse was grabbed.
+		struct Frame {
+			uint32_t keys;
+			glm::vec2 mouseVelocity;
+			float delta;
+		};
+
+		static const uint32_t grabbedBit = 1u << 31;
+
+		static std::vector<int> keys;
+		static std::vector<Frame> frames;
+		static std::ofstream file;
+
+		static int frame;
+		static bool recording, replaying;
+	};
 };
\ No newline at end of file
@@ -14,6 +14,11 @@ void TT::Time::update() {
 	this->time += delta;
 }
 
+void TT::Time::setDelta(float delta) {
+	time += delta - this->delta;
+	this->delta = delta;
+}
+
 float TT::Time::getDelta() {
 	return delta;
 }
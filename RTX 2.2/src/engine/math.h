@@ -7,6 +7,7 @@ namespace TT {
 		Time();
 
 		void update();
+		void setDelta(float delta);
 
 		float getDelta();
 		float getTime();
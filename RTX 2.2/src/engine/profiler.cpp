@@ -0,0 +1,166 @@
+#include <chrono>
+#include "profiler.h"
+
+// A few thousand frames at the current pass count, older events are dropped first.
+const static size_t maxEvents = 1 << 16;
+const static int gpuThread = 0;
+
+std::vector<TT::Profiler::Section> TT::Profiler::sections;
+std::deque<TT::Profiler::Event> TT::Profiler::events;
+std::mutex TT::Profiler::mutex;
+
+thread_local std::vector<TT::Profiler::Marker> TT::Profiler::markers;
+thread_local int TT::Profiler::threadIndex = -1;
+std::atomic<int> TT::Profiler::threadCount = 0;
+
+float TT::Profiler::frameHistory[historySize] = {};
+int TT::Profiler::historyOffset = 0;
+
+double TT::Profiler::frameStart = -1.0;
+float TT::Profiler::frameTime = 0.0f;
+
+TT::Profiler::Scope::Scope(const char* name, bool gpu) {
+	begin(name, gpu);
+}
+TT::Profiler::Scope::~Scope() {
+	end();
+}
+
+void TT::Profiler::beginFrame() {
+	double time = now();
+
+	if (frameStart >= 0.0) {
+		frameTime = (float)(time - frameStart);
+
+		frameHistory[historyOffset] = frameTime;
+		historyOffset = (historyOffset + 1) % historySize;
+
+		std::lock_guard<std::mutex> lock(mutex);
+		record({ "Frame", frameStart, frameTime, getThreadIndex() });
+	}
+
+	frameStart = time;
+}
+void TT::Profiler::clear() {
+	std::lock_guard<std::mutex> lock(mutex);
+
+	for (Section& section : sections) {
+		if (!section.gpuTimer) continue;
+
+		section.gpuTimer->clear();
+		delete section.gpuTimer;
+	}
+
+	sections.clear();
+	events.clear();
+}
+
+void TT::Profiler::begin(const char* name, bool gpu) {
+	int section = getSection(name);
+	double time = now();
+
+	if (gpu) {
+		std::lock_guard<std::mutex> lock(mutex);
+		Section& target = sections[section];
+
+		if (!target.gpuTimer) target.gpuTimer = new GpuTimer();
+		target.gpuTimer->begin(time);
+
+		// Results arrive a few frames late, they are traced at the time their pass was submitted.
+		if (target.gpuTimer->getTimestamp() > target.tracedTimestamp) {
+			target.gpuTime = target.gpuTimer->getTime();
+			target.tracedTimestamp = target.gpuTimer->getTimestamp();
+
+			record({ target.name + " (GPU)", target.tracedTimestamp, target.gpuTime, gpuThread });
+		}
+	}
+
+	markers.push_back({ section, gpu, time });
+}
+void TT::Profiler::end() {
+	Marker marker = markers.back();
+	markers.pop_back();
+
+	std::lock_guard<std::mutex> lock(mutex);
+	Section& target = sections[marker.section];
+
+	if (marker.gpu) target.gpuTimer->end();
+
+	float duration = (float)(now() - marker.start);
+	target.cpuTime = target.cpuTime > 0.0f ? glm::mix(target.cpuTime, duration, 0.1f) : duration;
+
+	record({ target.name, marker.start, duration, getThreadIndex() });
+}
+
+bool TT::Profiler::saveTrace(const char* location) {
+	std::ofstream file(location);
+	if (!file) {
+		std::cerr << "Could not write the trace to " << location << "\n";
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << gpuThread << ",\"args\":{\"name\":\"GPU\"}}";
+	for (int thread = 1; thread <= threadCount; thread++)
+		file << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << thread << ",\"args\":{\"name\":\"Thread " << thread << "\"}}";
+
+	// Chrome expects microseconds.
+	file << std::fixed;
+	for (const Event& event : events) {
+		file << ",\n{\"name\":\"" << event.name << "\",\"cat\":\"" << (event.thread == gpuThread ? "gpu" : "cpu") << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << event.thread;
+		file << ",\"ts\":" << event.start * 1000.0 << ",\"dur\":" << event.duration * 1000.0 << "}";
+	}
+
+	file << "\n]}\n";
+	return true;
+}
+
+std::vector<TT::Profiler::Section> TT::Profiler::getSections() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return sections;
+}
+const float* TT::Profiler::getFrameHistory() {
+	return frameHistory;
+}
+int TT::Profiler::getHistoryOffset() {
+	return historyOffset;
+}
+
+float TT::Profiler::getFrameTime() {
+	return frameTime;
+}
+float TT::Profiler::getGpuTime() {
+	std::lock_guard<std::mutex> lock(mutex);
+
+	float time = 0.0f;
+	for (const Section& section : sections) time += section.gpuTime;
+
+	return time;
+}
+
+double TT::Profiler::now() {
+	static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+int TT::Profiler::getThreadIndex() {
+	if (threadIndex < 0) threadIndex = ++threadCount;
+	return threadIndex;
+}
+int TT::Profiler::getSection(const char* name) {
+	std::lock_guard<std::mutex> lock(mutex);
+
+	for (int i = 0; i < (int)sections.size(); i++)
+		if (sections[i].name == name) return i;
+
+	sections.push_back(Section());
+	sections.back().name = name;
+
+	return (int)sections.size() - 1;
+}
+
+void TT::Profiler::record(const Event& event) {
+	events.push_back(event);
+	if (events.size() > maxEvents) events.pop_front();
+}
\ No newline at end of file
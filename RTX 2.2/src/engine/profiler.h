@@ -0,0 +1,80 @@
+#pragma once
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "graphics.h"
+
+namespace TT {
+	// Named CPU markers, optionally paired with a GPU timer, averaged for display and kept as a rolling
+	// Chrome trace. GPU sections use GL_TIME_ELAPSED and therefore must not nest.
+	class Profiler {
+	public:
+		struct Section {
+			std::string name;
+
+			float cpuTime = 0.0f;
+			float gpuTime = 0.0f;
+
+			GpuTimer* gpuTimer = NULL;
+			double tracedTimestamp = 0.0;
+		};
+
+		class Scope {
+		public:
+			Scope(const char* name, bool gpu = false);
+			~Scope();
+		};
+
+		static const int historySize = 240;
+
+		static void beginFrame();
+		static void clear();
+
+		static void begin(const char* name, bool gpu = false);
+		static void end();
+
+		static bool saveTrace(const char* location);
+
+		static std::vector<Section> getSections();
+		static const float* getFrameHistory();
+		static int getHistoryOffset();
+
+		static float getFrameTime();
+		static float getGpuTime();
+	private:
+		struct Event {
+			std::string name;
+			double start, duration;
+			int thread;
+		};
+		struct Marker {
+			int section;
+			bool gpu;
+
+			double start;
+		};
+
+		static std::vector<Section> sections;
+		static std::deque<Event> events;
+		static std::mutex mutex;
+
+		static thread_local std::vector<Marker> markers;
+		static thread_local int threadIndex;
+		static std::atomic<int> threadCount;
+
+		static float frameHistory[historySize];
+		static int historyOffset;
+
+		static double frameStart;
+		static float frameTime;
+
+		static double now();
+		static int getThreadIndex();
+		static int getSection(const char* name);
+
+		// Callers hold the mutex.
+		static void record(const Event& event);
+	};
+}
\ No newline at end of file
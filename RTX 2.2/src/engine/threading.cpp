@@ -0,0 +1,129 @@
+#include "threading.h"
+
+std::vector<std::thread> TT::ThreadPool::threads;
+std::vector<TT::ThreadPool::Worker*> TT::ThreadPool::workers;
+
+std::mutex TT::ThreadPool::wakeMutex;
+std::condition_variable TT::ThreadPool::wakeCondition;
+
+std::atomic<int> TT::ThreadPool::pendingJobs = 0;
+std::atomic<unsigned int> TT::ThreadPool::nextWorker = 0;
+bool TT::ThreadPool::running = false;
+
+thread_local int TT::ThreadPool::workerIndex = -1;
+
+void TT::ThreadPool::initialize(unsigned int threadCount) {
+	if (running) clear();
+
+	if (threadCount == 0) {
+		unsigned int hardwareThreads = std::thread::hardware_concurrency();
+		threadCount = hardwareThreads > 1 ? hardwareThreads - 1 : 1;
+	}
+
+	running = true;
+
+	for (unsigned int i = 0; i < threadCount; i++)
+		workers.push_back(new Worker());
+	for (unsigned int i = 0; i < threadCount; i++)
+		threads.push_back(std::thread(work, (int)i));
+}
+void TT::ThreadPool::clear() {
+	{
+		std::lock_guard<std::mutex> lock(wakeMutex);
+		running = false;
+	}
+	wakeCondition.notify_all();
+
+	for (std::thread& thread : threads) thread.join();
+	for (Worker* worker : workers) delete worker;
+
+	threads.clear();
+	workers.clear();
+
+	pendingJobs = 0;
+}
+
+void TT::ThreadPool::submit(std::function<void()> job) {
+	if (workers.empty()) {
+		job();
+		return;
+	}
+
+	push(workerIndex >= 0 ? workerIndex : nextWorker++ % workers.size(), std::move(job));
+}
+void TT::ThreadPool::parallelFor(int count, const std::function<void(int index)>& job) {
+	if (workers.empty()) {
+		for (int i = 0; i < count; i++) job(i);
+		return;
+	}
+
+	std::atomic<int> remaining = count;
+
+	// Spread the indices over every deque up front, idle workers steal from the others' fronts.
+	unsigned int firstWorker = nextWorker++;
+	for (int i = 0; i < count; i++) {
+		push((firstWorker + i) % workers.size(), [&job, &remaining, i]() {
+			job(i);
+			remaining--;
+		});
+	}
+
+	while (remaining > 0)
+		if (!runNext(workerIndex)) std::this_thread::yield();
+}
+
+unsigned int TT::ThreadPool::getThreadCount() {
+	return (unsigned int)workers.size() + 1;
+}
+
+void TT::ThreadPool::push(int worker, std::function<void()> job) {
+	{
+		std::lock_guard<std::mutex> lock(workers[worker]->mutex);
+		workers[worker]->jobs.push_back(std::move(job));
+	}
+
+	pendingJobs++;
+
+	std::lock_guard<std::mutex> lock(wakeMutex);
+	wakeCondition.notify_one();
+}
+bool TT::ThreadPool::runNext(int worker) {
+	std::function<void()> job;
+
+	if (worker >= 0) {
+		std::lock_guard<std::mutex> lock(workers[worker]->mutex);
+		if (!workers[worker]->jobs.empty()) {
+			job = std::move(workers[worker]->jobs.back());
+			workers[worker]->jobs.pop_back();
+		}
+	}
+
+	for (int i = 0; !job && i < (int)workers.size(); i++) {
+		Worker* victim = workers[(worker + 1 + i) % workers.size()];
+
+		std::lock_guard<std::mutex> lock(victim->mutex);
+		if (!victim->jobs.empty()) {
+			job = std::move(victim->jobs.front());
+			victim->jobs.pop_front();
+		}
+	}
+
+	if (!job) return false;
+
+	pendingJobs--;
+	job();
+
+	return true;
+}
+void TT::ThreadPool::work(int worker) {
+	workerIndex = worker;
+
+	while (true) {
+		if (runNext(worker)) continue;
+
+		std::unique_lock<std::mutex> lock(wakeMutex);
+		wakeCondition.wait(lock, []() { return !running || pendingJobs > 0; });
+
+		if (!running) return;
+	}
+}
\ No newline at end of file
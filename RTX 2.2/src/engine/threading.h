@@ -0,0 +1,74 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace TT {
+	class ThreadPool {
+	public:
+		static void initialize(unsigned int threadCount = 0);
+		static void clear();
+
+		static void submit(std::function<void()> job);
+		static void parallelFor(int count, const std::function<void(int index)>& job);
+
+		static unsigned int getThreadCount();
+	private:
+		struct Worker {
+			std::mutex mutex;
+			std::deque<std::function<void()>> jobs;
+		};
+
+		static std::vector<std::thread> threads;
+		static std::vector<Worker*> workers;
+
+		static std::mutex wakeMutex;
+		static std::condition_variable wakeCondition;
+
+		static std::atomic<int> pendingJobs;
+		static std::atomic<unsigned int> nextWorker;
+		static bool running;
+
+		static thread_local int workerIndex;
+
+		static void push(int worker, std::function<void()> job);
+		static bool runNext(int worker);
+		static void work(int worker);
+	};
+
+	// Hands the newest value from one writer thread to one reader thread without locking either. The writer fills
+	// getWriteBuffer() and publishes it, the reader switches to the latest published value on update() and keeps it until
+	// the next one, so a slow reader skips values instead of holding the writer up.
+	template<typename T> class TripleBuffer {
+	public:
+		T& getWriteBuffer() {
+			return buffers[writeIndex];
+		}
+		void publish() {
+			writeIndex = middle.exchange(writeIndex | freshBit, std::memory_order_acq_rel) & indexMask;
+		}
+
+		bool update() {
+			if (!(middle.load(std::memory_order_relaxed) & freshBit)) return false;
+
+			readIndex = middle.exchange(readIndex, std::memory_order_acq_rel) & indexMask;
+			return true;
+		}
+		const T& getReadBuffer() const {
+			return buffers[readIndex];
+		}
+	private:
+		static const int indexMask = 3;
+		static const int freshBit = 4;
+
+		T buffers[3] = {};
+		int writeIndex = 0, readIndex = 1;
+
+		// The spare buffer between the two sides, with freshBit set while it holds a value the reader has not taken.
+		std::atomic<int> middle = 2;
+	};
+}
\ No newline at end of file
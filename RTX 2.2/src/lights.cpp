@@ -0,0 +1,68 @@
+#include "lights.h"
+
+#define PI 3.1415926536f
+
+void RTX::LightList::build(const Map& map) {
+    clear();
+
+    std::vector<float> weights;
+
+    int boxCount = (int)map.boxes.size();
+    for (int primitive = 0; primitive < boxCount + (int)map.spheres.size(); primitive++) {
+        bool isBox = primitive < boxCount;
+
+        const Material& material = map.materials[isBox ? map.boxes[primitive].material : map.spheres[primitive - boxCount].material];
+        if (!material.emissive) continue;
+
+        float weight = getLuminance(material.color) * (isBox ? getArea(map.boxes[primitive]) : getArea(map.spheres[primitive - boxCount]));
+        if (weight <= 0.0f) continue;
+
+        lights.push_back({ primitive, 1.0f, (int)lights.size() });
+        weights.push_back(weight);
+
+        power += weight;
+    }
+
+    // Every bin holds one light and the remainder of a heavier one, so sampling costs one lookup regardless of the light count.
+    std::vector<int> small, large;
+    for (int i = 0; i < (int)lights.size(); i++) {
+        weights[i] *= lights.size() / power;
+        (weights[i] < 1.0f ? small : large).push_back(i);
+    }
+
+    while (!small.empty() && !large.empty()) {
+        int lesser = small.back();
+        int greater = large.back();
+        small.pop_back();
+
+        lights[lesser].probability = weights[lesser];
+        lights[lesser].alias = greater;
+
+        weights[greater] -= 1.0f - weights[lesser];
+        if (weights[greater] < 1.0f) {
+            large.pop_back();
+            small.push_back(greater);
+        }
+    }
+}
+void RTX::LightList::clear() {
+    lights.clear();
+    power = 0.0f;
+}
+
+int RTX::LightList::sample(float random) const {
+    float scaled = random * lights.size();
+    int bin = glm::min((int)scaled, (int)lights.size() - 1);
+
+    return scaled - bin < lights[bin].probability ? bin : lights[bin].alias;
+}
+
+float RTX::LightList::getLuminance(glm::vec3 color) {
+    return glm::dot(color, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+}
+float RTX::LightList::getArea(const Box& box) {
+    return 2.0f * (box.scale.x * box.scale.y + box.scale.y * box.scale.z + box.scale.z * box.scale.x);
+}
+float RTX::LightList::getArea(const Sphere& sphere) {
+    return 4.0f * PI * sphere.radius * sphere.radius;
+}
\ No newline at end of file
@@ -0,0 +1,28 @@
+#pragma once
+#include "rtx.h"
+
+namespace RTX {
+    // Emissive boxes and spheres of a map, picked with probability proportional to area times luminance through
+    // Vose's alias table. Primitive ids follow the BVH: boxes first, then spheres offset by the box count.
+    class LightList {
+    public:
+        struct Light {
+            int primitive;
+
+            float probability;
+            int alias;
+        };
+
+        std::vector<Light> lights;
+        float power = 0.0f;
+
+        void build(const Map& map);
+        void clear();
+
+        int sample(float random) const;
+
+        static float getLuminance(glm::vec3 color);
+        static float getArea(const Box& box);
+        static float getArea(const Sphere& sphere);
+    };
+}
\ No newline at end of file
@@ -1,13 +1,30 @@
 ﻿#include <windows.h>
 #include <fstream>
+#include <mutex>
+#include <thread>
 #include <vector>
 #include <unordered_map>
 #include "engine/graphics.h"
 #include "engine/math.h"
 #include "engine/input.h"
 #include "rtx.h"
+#include "tracer.h"
+#include "benchmark.h"
+#include "mapfile.h"
+
+int main(int argc, char** argv) {
+    if (argc > 1 && std::string(argv[1]) == "--benchmark")
+        return RTX::Benchmark::run(argc - 2, argv + 2);
+
+    // Writes <map>.rtmapb next to the source unless told otherwise, World::initialize prefers it while it is up to date.
+    if (argc > 2 && std::string(argv[1]) == "--compile") {
+        std::string destination = argc > 3 ? argv[3] : std::string(argv[2]) + "b";
+        RTX::MapFile::compile(argv[2], destination.c_str());
+
+        std::cout << "Compiled " << argv[2] << " to " << destination << "\n";
+        return 0;
+    }
 
-int main() {
     if (!TT::Window::create(1920, 1080, "SUPER 3D YOPTA!", true, false)) {
         std::cerr << "Could not create a window...\n";
         return 1;
@@ -17,14 +34,16 @@ int main() {
 
     TT::Window::initializeImGui(TT_IMGUI_THEME_LIGHT);
 
+    // Map textures decode on the pool while the rest starts up.
+    TT::ThreadPool::initialize();
+
     RTX::World::initialize("old", 25.0f, glm::vec3(-1.0f, 1.0f, -0.175f));
     RTX::Camera::initialize(0.05f, 12.0f, 90.0f);
     RTX::Renderer::initialize(TT::Window::getSize());
 
-    RTX::Player player(glm::vec3(-1.5f, 5.0f, -1.5f), glm::vec3(), glm::vec3(0.4f, 1.76f, 0.4f));
+    RTX::Tracer::initialize(TT::Window::getSize());
 
-    float fpsUpdateTime = 0.0f;
-    int fps = 0;
+    RTX::Player player(glm::vec3(-1.5f, 5.0f, -1.5f), glm::vec3(), glm::vec3(0.4f, 1.76f, 0.4f));
 
     TT::Mouse::initialize();
     TT::Mouse::setGrabbed(true);
@@ -32,75 +51,193 @@ int main() {
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-    ALuint musicSound = TT::AudioSystem::loadFromFile("res/sounds/music.ogg");
     TT::SoundSource musicSoundSource;
-    musicSoundSource.play(musicSound, 0.05f, 1.0f, true);
+    musicSoundSource.stream("res/sounds/music.ogg", 0.05f, 1.0f, true);
 
-    int frame = 0;
-    int mouseGrabFrame = 0;
+    // Sessions are recorded with --record <file> and played back with --replay <file>, the log covers every key read below.
+    // --latency prints the time from polling input to the frame built from it being on screen, once a second.
+    bool measureLatency = false;
 
-    glm::vec2 lastWindowSize = TT::Window::getSize();
+    for (int i = 1; i < argc; i++) {
+        std::string option = argv[i];
 
-    TT::Time time;
-    while (TT::Window::isRunning()) {
-        TT::Window::update();
-        TT::Mouse::update();
+        if (option == "--latency") measureLatency = true;
+        else if (option == "--record" && i + 1 < argc) TT::InputLog::startRecording(argv[++i], { GLFW_KEY_W, GLFW_KEY_A, GLFW_KEY_S, GLFW_KEY_D, GLFW_KEY_SPACE, GLFW_KEY_LEFT_SHIFT, GLFW_KEY_ESCAPE });
+        else if (option == "--replay" && i + 1 < argc) TT::InputLog::startReplay(argv[++i]);
+    }
 
-        RTX::Renderer::render(time, player);
+    // The window thread polls input and steps the player at the simulation rate, the render thread draws the newest
+    // view whenever a frame finishes. A slow trace only delays the picture, never input or physics.
+    RTX::View lastView = { player.getEyePosition(), player.rotation, TT::Mouse::isGrabbed(), glfwGetTime() };
 
-        frame++;
-        if (TT::Keyboard::isPressed(GLFW_KEY_ESCAPE)) {
-            if (!mouseGrabFrame) {
-                TT::Mouse::setGrabbed(!TT::Mouse::isGrabbed());
-                mouseGrabFrame = frame;
+    TT::TripleBuffer<RTX::View> views;
+    views.getWriteBuffer() = lastView;
+    views.publish();
+
+    // Guards the player against the settings window, which only shows while the mouse is released.
+    std::mutex playerMutex;
+
+    std::atomic<bool> rendering = true;
+    std::atomic<int> fps = 0;
+
+    glfwMakeContextCurrent(NULL);
+
+    std::thread renderThread([&]() {
+        glfwMakeContextCurrent(TT::Window::getId());
+
+        glm::vec2 lastWindowSize = TT::Window::getSize();
+        float fpsUpdateTime = 0.0f;
+        int frames = 0;
+
+        double latencySum = 0.0, latencyMax = 0.0;
+        int latencyFrames = 0;
+
+        TT::Time time;
+        while (rendering) {
+            TT::Profiler::beginFrame();
+
+            TT::Window::swapBuffers();
+
+            // Waiting for the GPU makes the timestamp the moment the frame is really out, the CPU no longer queues frames ahead meanwhile.
+            if (measureLatency && RTX::Renderer::getView().inputTime > 0.0) {
+                glFinish();
+
+                double latency = (glfwGetTime() - RTX::Renderer::getView().inputTime) * 1000.0;
+                latencySum += latency;
+                latencyMax = glm::max(latencyMax, latency);
+                latencyFrames++;
             }
-        } else mouseGrabFrame = 0;
 
-        if (player.position.y <= -50.0f) player.respawn();
+            // Accumulated frames were lit with the placeholder.
+            if (TT::Texture::update()) RTX::Renderer::resetDenoiser();
 
-        glm::vec3 lastPlayerPos = glm::vec3(player.position);
-        glm::vec3 lastPlayerAngle = glm::vec3(player.rotation);
+            RTX::Renderer::render(views);
+            const RTX::View& view = RTX::Renderer::getView();
 
-        if(TT::Mouse::isGrabbed()) player.update(time);
+            time.update();
+            RTX::Governor::update(time.getDelta() * 1000.0f, TT::Profiler::getGpuTime());
 
-        time.update();
+            fpsUpdateTime += time.getDelta();
+            frames++;
+
+            if (fpsUpdateTime >= 1.0f) {
+                fps = frames;
+
+                fpsUpdateTime = 0.0f;
+                frames = 0;
+
+                if (latencyFrames) {
+                    std::cout << "Input to present: " << latencySum / latencyFrames << " ms average, " << latencyMax << " ms worst over " << latencyFrames << " frames\n";
+
+                    latencySum = latencyMax = 0.0;
+                    latencyFrames = 0;
+                }
+            }
 
-        fpsUpdateTime += time.getDelta();
-        fps++;
-        
-        if (fpsUpdateTime >= 1.0f) {
-            TT::Window::setTitle(std::string("SUPER 3D YOPTA! Fps: " + std::to_string(fps)).c_str());
+            {
+                TT::Profiler::Scope scope("ImGui", true);
+                TT::Window::beginImGui();
 
-            fpsUpdateTime = 0.0f;
-            fps = 0;
+                if (!view.grabbed) {
+                    std::lock_guard<std::mutex> lock(playerMutex);
+                    RTX::DebugHud::render(player);
+                }
+
+                TT::Window::endImGui();
+            }
+
+            glm::vec2 windowSize = TT::Window::getSize();
+            if (lastWindowSize != windowSize) {
+                lastWindowSize = glm::vec2(windowSize);
+
+                if (RTX::DebugHud::getFrameScaleMode()) windowSize *= RTX::DebugHud::getFrameScale();
+                else windowSize /= RTX::DebugHud::getFrameScale();
+
+                RTX::Renderer::resize(windowSize);
+            }
+        }
+
+        glfwMakeContextCurrent(NULL);
+    });
+
+    int tick = 0;
+    int mouseGrabTick = 0;
+
+    int shownFps = -1;
+
+    double replayStart = glfwGetTime();
+    double nextTick = replayStart;
+
+    TT::Time time;
+    while (TT::Window::isRunning()) {
+        // Events are handled as they arrive, the simulation only runs once its tick is due.
+        TT::Window::pollEvents(nextTick - glfwGetTime());
+        if (glfwGetTime() < nextTick) continue;
+
+        // After a stall the ticks restart from now, Player::update catches up on the lost time in substeps.
+        nextTick = glm::max(nextTick + RTX::Player::timeStep, glfwGetTime());
+
+        double inputTime = glfwGetTime();
+
+        time.update();
+        TT::Mouse::update();
+
+        TT::InputLog::update(time);
+        if (TT::InputLog::isFinished()) {
+            std::cout << "Replayed " << tick << " ticks in " << glfwGetTime() - replayStart << " s\n";
+            break;
         }
 
-        TT::Window::beginImGui();
+        tick++;
+        if (TT::Keyboard::isPressed(GLFW_KEY_ESCAPE)) {
+            if (!mouseGrabTick) {
+                TT::Mouse::setGrabbed(!TT::Mouse::isGrabbed());
+                mouseGrabTick = tick;
+            }
+        } else mouseGrabTick = 0;
 
-        if (!TT::Mouse::isGrabbed())
-            RTX::DebugHud::render(player);
+        // The settings window may hold the player through a whole CPU reference render, input keeps being polled meanwhile.
+        // A grabbed mouse means the player simulates this tick, so it waits for the window instead of dropping the tick and breaking replays.
+        std::unique_lock<std::mutex> lock(playerMutex, std::defer_lock);
+        if (TT::Mouse::isGrabbed()) lock.lock();
+        else lock.try_lock();
 
-        TT::Window::endImGui();
+        if (lock.owns_lock()) {
+            if (player.position.y <= -50.0f) player.respawn();
+            if (TT::Mouse::isGrabbed()) player.update(time);
 
-        glm::vec2 windowSize = TT::Window::getSize();
-        if (lastWindowSize != windowSize) {
-            lastWindowSize = glm::vec2(windowSize);
+            lastView = { player.getEyePosition(), player.rotation, TT::Mouse::isGrabbed(), inputTime };
+            lock.unlock();
+        }
+        else lastView.grabbed = TT::Mouse::isGrabbed();
 
-            if (RTX::DebugHud::getFrameScaleMode()) windowSize *= RTX::DebugHud::getFrameScale();
-            else windowSize /= RTX::DebugHud::getFrameScale();
+        views.getWriteBuffer() = lastView;
+        views.publish();
 
-            RTX::Renderer::resize(windowSize);
+        if (fps != shownFps) {
+            shownFps = fps;
+            TT::Window::setTitle(std::string("SUPER 3D YOPTA! Fps: " + std::to_string(shownFps)).c_str());
         }
     }
 
+    rendering = false;
+    renderThread.join();
+
+    glfwMakeContextCurrent(TT::Window::getId());
+
+    TT::InputLog::stop();
+
+    RTX::Tracer::clear();
+    TT::ThreadPool::clear();
+
     RTX::World::clear();
     RTX::Renderer::clear();
+    TT::Profiler::clear();
 
     player.clear();
 
     musicSoundSource.clear();
 
-    TT::AudioSystem::clear(musicSound);
     TT::AudioSystem::clear();
 
     TT::Window::clearImGui();
@@ -0,0 +1,243 @@
+#include <cstring>
+#include <filesystem>
+#include <unordered_map>
+#include "mapfile.h"
+#include "engine/files.h"
+
+void RTX::MapFile::compile(const char* source, const char* destination) {
+    Map map = MapParser::parse(source, false);
+
+    BVH bvh;
+    bvh.build(map.boxes, map.spheres);
+
+    save(map, bvh, destination);
+}
+void RTX::MapFile::save(const Map& map, const BVH& bvh, const char* location) {
+    static_assert(sizeof(MaterialRecord) == 44, "Material records must stay 44 bytes");
+
+    std::vector<std::string> strings;
+    std::unordered_map<std::string, uint32_t> stringIndices;
+
+    auto intern = [&](const std::string& string) {
+        auto [iterator, added] = stringIndices.emplace(string, (uint32_t)strings.size());
+        if (added) strings.push_back(string);
+
+        return iterator->second;
+    };
+
+    Header header = {};
+    memcpy(header.magic, "RTMB", 4);
+    header.version = version;
+
+    header.materialCount = (uint32_t)map.materials.size();
+    header.boxCount = (uint32_t)map.boxes.size();
+    header.sphereCount = (uint32_t)map.spheres.size();
+    header.nodeCount = (uint32_t)bvh.nodes.size();
+    header.primitiveCount = (uint32_t)bvh.primitives.size();
+
+    header.albedoLocation = intern(map.albedoLocation);
+    header.normalLocation = intern(map.normalLocation);
+    header.skyboxLocation = intern(map.skyboxLocation);
+
+    std::vector<MaterialRecord> materials;
+    for (const Material& material : map.materials)
+        materials.push_back({ material.color, material.diffuse, material.glass, material.glassReflect, material.uvInfo, material.emissive ? 1u : 0u });
+
+    std::vector<glm::vec3> boxPositions, boxScales, spherePositions;
+    std::vector<float> sphereRadii;
+    std::vector<int32_t> boxMaterials, sphereMaterials;
+    std::vector<uint32_t> boxTags, sphereTags;
+
+    for (const Box& box : map.boxes) {
+        boxPositions.push_back(box.position);
+        boxScales.push_back(box.scale);
+        boxMaterials.push_back(box.material);
+        boxTags.push_back(intern(Tags::getName(box.tag)));
+    }
+    for (const Sphere& sphere : map.spheres) {
+        spherePositions.push_back(sphere.position);
+        sphereRadii.push_back(sphere.radius);
+        sphereMaterials.push_back(sphere.material);
+        sphereTags.push_back(intern(Tags::getName(sphere.tag)));
+    }
+
+    std::vector<uint32_t> stringOffsets = { 0 };
+    std::string stringData;
+    for (const std::string& string : strings) {
+        stringData += string;
+        stringOffsets.push_back((uint32_t)stringData.size());
+    }
+
+    header.stringCount = (uint32_t)strings.size();
+
+    std::vector<char> data(sizeof(Header));
+    auto append = [&](SectionType type, const void* section, size_t size) {
+        data.resize((data.size() + alignment - 1) / alignment * alignment);
+
+        header.sections[type] = { data.size(), size };
+        data.insert(data.end(), (const char*)section, (const char*)section + size);
+    };
+
+    append(MATERIALS, materials.data(), materials.size() * sizeof(MaterialRecord));
+    append(BOX_POSITIONS, boxPositions.data(), boxPositions.size() * sizeof(glm::vec3));
+    append(BOX_SCALES, boxScales.data(), boxScales.size() * sizeof(glm::vec3));
+    append(BOX_MATERIALS, boxMaterials.data(), boxMaterials.size() * sizeof(int32_t));
+    append(BOX_TAGS, boxTags.data(), boxTags.size() * sizeof(uint32_t));
+    append(SPHERE_POSITIONS, spherePositions.data(), spherePositions.size() * sizeof(glm::vec3));
+    append(SPHERE_RADII, sphereRadii.data(), sphereRadii.size() * sizeof(float));
+    append(SPHERE_MATERIALS, sphereMaterials.data(), sphereMaterials.size() * sizeof(int32_t));
+    append(SPHERE_TAGS, sphereTags.data(), sphereTags.size() * sizeof(uint32_t));
+    append(NODES, bvh.nodes.data(), bvh.nodes.size() * sizeof(BVH::Node));
+    append(PRIMITIVES, bvh.primitives.data(), bvh.primitives.size() * sizeof(int));
+    append(STRING_OFFSETS, stringOffsets.data(), stringOffsets.size() * sizeof(uint32_t));
+    append(STRINGS, stringData.data(), stringData.size());
+
+    memcpy(data.data(), &header, sizeof(Header));
+
+    std::ofstream file(location, std::ios::binary);
+    if (!file.write(data.data(), data.size()))
+        throw std::runtime_error(std::string("Could not write map: \"" + std::string(location) + "\""));
+}
+RTX::Map RTX::MapFile::load(const char* location, BVH& bvh, bool loadTextures) {
+    TT::MappedFile file(location);
+    if (!file.isOpen()) throw std::runtime_error(std::string("Could not load map: \"" + std::string(location) + "\""));
+
+    const char* data = (const char*)file.getData();
+    const Header* header = (const Header*)data;
+
+    auto fail = [&](const char* reason) {
+        file.clear();
+        throw std::runtime_error(std::string("Could not load map: \"" + std::string(location) + "\", " + reason));
+    };
+
+    if (file.getSize() < sizeof(Header) || memcmp(header->magic, "RTMB", 4) != 0) fail("not a compiled map");
+    if (header->version != version) fail("compiled by another version, recompile it");
+
+    const size_t counts[SECTION_COUNT] = {
+        header->materialCount * sizeof(MaterialRecord),
+        header->boxCount * sizeof(glm::vec3), header->boxCount * sizeof(glm::vec3), header->boxCount * sizeof(int32_t), header->boxCount * sizeof(uint32_t),
+        header->sphereCount * sizeof(glm::vec3), header->sphereCount * sizeof(float), header->sphereCount * sizeof(int32_t), header->sphereCount * sizeof(uint32_t),
+        header->nodeCount * sizeof(BVH::Node), header->primitiveCount * sizeof(int), (header->stringCount + 1) * sizeof(uint32_t), 0
+    };
+
+    for (int i = 0; i < SECTION_COUNT; i++) {
+        const Section& section = header->sections[i];
+
+        if (section.offset > file.getSize() || section.size > file.getSize() - section.offset) fail("truncated");
+        if (i != STRINGS && section.size != counts[i]) fail("corrupted");
+    }
+
+    auto get = [&](SectionType type) {
+        return data + header->sections[type].offset;
+    };
+
+    const uint32_t* stringOffsets = (const uint32_t*)get(STRING_OFFSETS);
+    if (stringOffsets[header->stringCount] > header->sections[STRINGS].size) fail("corrupted");
+
+    for (uint32_t i = 0; i < header->stringCount; i++)
+        if (stringOffsets[i] > stringOffsets[i + 1]) fail("corrupted");
+
+    std::vector<std::string> strings;
+    strings.reserve(header->stringCount);
+    for (uint32_t i = 0; i < header->stringCount; i++)
+        strings.push_back(std::string(get(STRINGS) + stringOffsets[i], stringOffsets[i + 1] - stringOffsets[i]));
+
+    auto getString = [&](uint32_t index) {
+        if (index >= strings.size()) fail("corrupted");
+        return strings[index];
+    };
+
+    // Tag ids are per run, so stored names are interned the first time a primitive refers to them.
+    // The string table also holds texture locations, which must not take up tag ids.
+    std::vector<int> tags(header->stringCount, -1);
+
+    auto getMaterial = [&](int32_t material) {
+        if (material < 0 || (uint32_t)material >= header->materialCount) fail("corrupted");
+        return material;
+    };
+
+    auto getTag = [&](uint32_t index) {
+        if (index >= tags.size()) fail("corrupted");
+        if (tags[index] < 0) tags[index] = Tags::intern(strings[index]);
+
+        return tags[index];
+    };
+
+    std::vector<Material> materials;
+    materials.reserve(header->materialCount);
+
+    const MaterialRecord* materialRecords = (const MaterialRecord*)get(MATERIALS);
+    for (uint32_t i = 0; i < header->materialCount; i++) {
+        const MaterialRecord& record = materialRecords[i];
+        materials.push_back(Material(record.color, record.diffuse, record.glass, record.glassReflect, record.uvInfo, record.emissive != 0));
+    }
+
+    std::vector<Box> boxes;
+    boxes.reserve(header->boxCount);
+
+    const glm::vec3* boxPositions = (const glm::vec3*)get(BOX_POSITIONS);
+    const glm::vec3* boxScales = (const glm::vec3*)get(BOX_SCALES);
+    const int32_t* boxMaterials = (const int32_t*)get(BOX_MATERIALS);
+    const uint32_t* boxTags = (const uint32_t*)get(BOX_TAGS);
+
+    for (uint32_t i = 0; i < header->boxCount; i++)
+        boxes.push_back(Box(boxPositions[i], boxScales[i], getMaterial(boxMaterials[i]), getTag(boxTags[i])));
+
+    std::vector<Sphere> spheres;
+    spheres.reserve(header->sphereCount);
+
+    const glm::vec3* spherePositions = (const glm::vec3*)get(SPHERE_POSITIONS);
+    const float* sphereRadii = (const float*)get(SPHERE_RADII);
+    const int32_t* sphereMaterials = (const int32_t*)get(SPHERE_MATERIALS);
+    const uint32_t* sphereTags = (const uint32_t*)get(SPHERE_TAGS);
+
+    for (uint32_t i = 0; i < header->sphereCount; i++)
+        spheres.push_back(Sphere(spherePositions[i], sphereRadii[i], getMaterial(sphereMaterials[i]), getTag(sphereTags[i])));
+
+    const BVH::Node* nodes = (const BVH::Node*)get(NODES);
+    const int* primitives = (const int*)get(PRIMITIVES);
+
+    // Traversal trusts the hierarchy, so leaves must stay inside the primitive list and children must come after
+    // their parent. Node 1 is padding and never visited.
+    for (uint32_t i = 0; i < header->nodeCount; i++) {
+        const BVH::Node& node = nodes[i];
+        if (i == 1) continue;
+
+        if (node.count > 0) {
+            if (node.leftFirst < 0 || (uint32_t)node.leftFirst > header->primitiveCount || (uint32_t)node.count > header->primitiveCount - node.leftFirst) fail("corrupted");
+        }
+        else if (node.count < 0 || node.leftFirst <= (int)i || (uint32_t)node.leftFirst + 1 >= header->nodeCount) fail("corrupted");
+    }
+
+    for (uint32_t i = 0; i < header->primitiveCount; i++)
+        if (primitives[i] < 0 || (uint32_t)primitives[i] >= header->boxCount + header->sphereCount) fail("corrupted");
+
+    bvh.clear();
+    bvh.nodes.assign(nodes, nodes + header->nodeCount);
+    bvh.primitives.assign(primitives, primitives + header->primitiveCount);
+
+    std::string albedoLocation = getString(header->albedoLocation);
+    std::string normalLocation = getString(header->normalLocation);
+    std::string skyboxLocation = getString(header->skyboxLocation);
+
+    file.clear();
+
+    Map map(0, 0, 0, std::move(materials), std::move(boxes), std::move(spheres));
+    map.albedoLocation = albedoLocation;
+    map.normalLocation = normalLocation;
+    map.skyboxLocation = skyboxLocation;
+
+    if (loadTextures) map.loadTextures();
+
+    return map;
+}
+
+bool RTX::MapFile::isCurrent(const char* location, const char* source) {
+    std::error_code error;
+
+    auto compiledTime = std::filesystem::last_write_time(location, error);
+    if (error) return false;
+
+    auto sourceTime = std::filesystem::last_write_time(source, error);
+    return error || compiledTime >= sourceTime;
+}
\ No newline at end of file
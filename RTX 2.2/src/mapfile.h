@@ -0,0 +1,54 @@
+#pragma once
+#include <cstdint>
+#include "bvh.h"
+
+namespace RTX {
+    // Compiled maps: a versioned little-endian image of a parsed .rtmap and its BVH. Primitives are stored as
+    // arrays per field, tags and texture locations as indices into one string table, and every section starts
+    // on a cache line so the loader copies straight out of the mapping without parsing anything.
+    class MapFile {
+    public:
+        static const uint32_t version = 1;
+
+        static void compile(const char* source, const char* destination);
+        static void save(const Map& map, const BVH& bvh, const char* location);
+        static Map load(const char* location, BVH& bvh, bool loadTextures = true);
+
+        // A compiled map is only used while it is at least as new as its source.
+        static bool isCurrent(const char* location, const char* source);
+    private:
+        enum SectionType {
+            MATERIALS, BOX_POSITIONS, BOX_SCALES, BOX_MATERIALS, BOX_TAGS,
+            SPHERE_POSITIONS, SPHERE_RADII, SPHERE_MATERIALS, SPHERE_TAGS,
+            NODES, PRIMITIVES, STRING_OFFSETS, STRINGS, SECTION_COUNT
+        };
+
+        struct Section {
+            uint64_t offset, size;
+        };
+        struct Header {
+            char magic[4];
+            uint32_t version;
+
+            uint32_t materialCount, boxCount, sphereCount;
+            uint32_t nodeCount, primitiveCount, stringCount;
+            uint32_t albedoLocation, normalLocation, skyboxLocation;
+            uint32_t padding;
+
+            Section sections[SECTION_COUNT];
+        };
+        struct MaterialRecord {
+            glm::vec3 color;
+
+            float diffuse;
+            float glass;
+            float glassReflect;
+
+            glm::vec4 uvInfo;
+
+            uint32_t emissive;
+        };
+
+        static const size_t alignment = 64;
+    };
+}
\ No newline at end of file
@@ -1,141 +1,278 @@
+#include <algorithm>
+#include <charconv>
 #include "rtx.h"
+#include "bvh.h"
+#include "lights.h"
+#include "mapfile.h"
+#include "tracer.h"
+#include "engine/files.h"
+
+// Must match raytrace.frag, a pixel never spends more than this many times the rays per pixel in one frame.
+#define ADAPTIVE_SAMPLE_LIMIT 4
 
 RTX::Material::Material(glm::vec3 color, float diffuse, float glass, float glassReflect, glm::vec4 uvInfo, bool emissive)
     : color(color), diffuse(diffuse), glass(glass), glassReflect(glassReflect), uvInfo(uvInfo), emissive(emissive) {};
 
-RTX::Box::Box(glm::vec3 position, glm::vec3 scale, int material, std::string tag) : position(position), scale(scale), material(material), tag(tag) {}
-RTX::Sphere::Sphere(glm::vec3 position, float radius, int material, std::string tag) : position(position), radius(radius), material(material), tag(tag) {}
+std::vector<std::string> RTX::Tags::names = { "" };
+std::map<std::string, int, std::less<>> RTX::Tags::ids = { { "", 0 } };
+
+int RTX::Tags::intern(std::string_view name) {
+    auto found = ids.find(name);
+    if (found != ids.end()) return found->second;
+
+    int tag = (int)names.size();
+    names.push_back(std::string(name));
+    ids.emplace(std::string(name), tag);
+
+    return tag;
+}
+
+const std::string& RTX::Tags::getName(int tag) {
+    return names[tag];
+}
+uint32_t RTX::Tags::getMask(int tag) {
+    return tag > 0 && tag < maskBits ? 1u << tag : 0u;
+}
+
+void RTX::Triggers::update(uint32_t touching) {
+    uint32_t touched = getTouching();
+
+    enter = touching & ~touched;
+    stay = touching & touched;
+    exit = touched & ~touching;
+}
+uint32_t RTX::Triggers::getTouching() const {
+    return enter | stay;
+}
+
+RTX::Box::Box(glm::vec3 position, glm::vec3 scale, int material, int tag) : position(position), scale(scale), material(material), tag(tag) {}
+RTX::Sphere::Sphere(glm::vec3 position, float radius, int material, int tag) : position(position), radius(radius), material(material), tag(tag) {}
 
 RTX::Map::Map(
     int albedoTexture, int normalTexture, int skyboxTexture,
     std::vector<RTX::Material> materials, std::vector<RTX::Box> boxes, std::vector<RTX::Sphere> spheres
 ) :
     albedoTexture(albedoTexture), normalTexture(normalTexture), skyboxTexture(skyboxTexture),
-    materials(materials), boxes(boxes), spheres(spheres)
+    materials(std::move(materials)), boxes(std::move(boxes)), spheres(std::move(spheres))
 {}
 
-RTX::Map RTX::MapParser::parse(const char* location) {
-    std::ifstream file(location);
+void RTX::Map::loadTextures() {
+    // Same fallbacks as the CPU tracer: white albedo, flat normals and a black sky.
+    albedoTexture = TT::Texture::loadFromFileAsync(albedoLocation.c_str(), GL_LINEAR, glm::vec4(1.0f));
+    normalTexture = TT::Texture::loadFromFileAsync(normalLocation.c_str(), GL_LINEAR, glm::vec4(0.5f, 0.5f, 1.0f, 1.0f));
+    skyboxTexture = TT::Texture::loadFromFileAsync(skyboxLocation.c_str(), GL_LINEAR, glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+}
+
+RTX::Map RTX::MapParser::parse(const char* location, bool loadTextures) {
+    TT::MappedFile file(location);
+    if (!file.isOpen()) throw std::runtime_error(std::string("Could not parse map: \"" + std::string(location) + "\""));
 
     std::vector<RTX::Material> materials;
     std::vector<RTX::Box> boxes;
     std::vector<RTX::Sphere> spheres;
 
-    int albedoTexture = 0, normalTexture = 0, skyboxTexture = 0;
-
-    if (!file.is_open()) {
-        throw std::runtime_error(std::string("Could not parse map: \"" + std::string(location) + "\""));
-        return RTX::Map(albedoTexture, normalTexture, skyboxTexture, materials, boxes, spheres);
-    }
+    std::string albedoLocation, normalLocation, skyboxLocation;
 
+    std::string_view data((const char*)file.getData(), file.getSize());
     ReadMode readMode = INFO;
 
-    while (file) {
-        std::string line;
-        getline(file, line);
+    Line line = { location, 0, {} };
 
-        if (line.starts_with("Info")) readMode = INFO;
-        else if (line.starts_with("Materials")) readMode = MATERIAL;
-        else if (line.starts_with("Boxes")) readMode = BOX;
-        else if (line.starts_with("Spheres")) readMode = SPHERE;
-        else {
-            if (line == "" || line.starts_with("//")) continue;
+    // Every line is at most one box, growing the vector while parsing cost more than the scan.
+    boxes.reserve(std::count(data.begin(), data.end(), '\n') + 1);
 
-            std::stringstream lineStream(line);
+    try {
+        while (!data.empty()) {
+            size_t end = data.find('\n');
 
-            if (readMode == INFO) {
-                albedoTexture = TT::Texture::loadFromFile(("res/textures/" + getNextSplit(lineStream, '/')).c_str(), GL_LINEAR);
-                normalTexture = TT::Texture::loadFromFile(("res/textures/" + getNextSplit(lineStream, '/')).c_str(), GL_LINEAR);
-                skyboxTexture = TT::Texture::loadFromFile(("res/textures/" + getNextSplit(lineStream, '/')).c_str(), GL_LINEAR);
-            }
-            else if (readMode == MATERIAL) {
-                std::stringstream vectorStream = getNextStreamSplit(lineStream, '/');
+            line.number++;
+            line.text = data.substr(0, end);
+            data.remove_prefix(end == std::string_view::npos ? data.size() : end + 1);
 
-                float red = getNextSplit<float>(vectorStream, ',');
-                float green = getNextSplit<float>(vectorStream, ',');
-                float blue = getNextSplit<float>(vectorStream, ',');
+            if (!line.text.empty() && line.text.back() == '\r') line.text.remove_suffix(1);
 
-                float diffuse = getNextSplit<float>(lineStream, '/');
-                float glass = getNextSplit<float>(lineStream, '/');
-                float glassReflect = getNextSplit<float>(lineStream, '/');
+            if (line.text.starts_with("Info")) readMode = INFO;
+            else if (line.text.starts_with("Materials")) readMode = MATERIAL;
+            else if (line.text.starts_with("Boxes")) readMode = BOX;
+            else if (line.text.starts_with("Spheres")) readMode = SPHERE;
+            else {
+                if (line.text.find_first_not_of(" \t") == std::string_view::npos || line.text.starts_with("//")) continue;
 
-                vectorStream = getNextStreamSplit(lineStream, '/');
+                std::string_view rest = line.text;
 
-                float uvX = getNextSplit<float>(vectorStream, ',');
-                float uvY = getNextSplit<float>(vectorStream, ',');
-                float uvWidth = getNextSplit<float>(vectorStream, ',');
-                float uvHeight = getNextSplit<float>(vectorStream, ',');
+                if (readMode == INFO) {
+                    albedoLocation = "res/textures/" + std::string(getNextSplit(line, rest, '/'));
+                    normalLocation = "res/textures/" + std::string(getNextSplit(line, rest, '/'));
+                    skyboxLocation = "res/textures/" + std::string(getNextSplit(line, rest, '/'));
+                }
+                else if (readMode == MATERIAL) {
+                    glm::vec3 color = getNextVector(line, rest);
 
-                bool emissive = getNextSplit(lineStream, '/') == "true";
+                    float diffuse = getNextSplit<float>(line, rest, '/');
+                    float glass = getNextSplit<float>(line, rest, '/');
+                    float glassReflect = getNextSplit<float>(line, rest, '/');
 
-                materials.push_back(RTX::Material(glm::vec3(red, green, blue), diffuse, glass, glassReflect, glm::vec4(uvX, uvY, uvWidth, uvHeight), emissive));
-            }
-            else if (readMode == BOX) {
-                std::stringstream positionStream = getNextStreamSplit(lineStream, '/');
-                std::stringstream scaleStream = getNextStreamSplit(lineStream, '/');
+                    std::string_view uvField = getNextSplit(line, rest, '/');
 
-                float x = getNextSplit<float>(positionStream, ',');
-                float y = getNextSplit<float>(positionStream, ',');
-                float z = getNextSplit<float>(positionStream, ',');
+                    glm::vec4 uvInfo;
+                    uvInfo.x = getNextSplit<float>(line, uvField, ',');
+                    uvInfo.y = getNextSplit<float>(line, uvField, ',');
+                    uvInfo.z = getNextSplit<float>(line, uvField, ',');
+                    uvInfo.w = getNextSplit<float>(line, uvField, ',');
+                    expectEnd(line, uvField, ',');
 
-                float width = getNextSplit<float>(scaleStream, ',');
-                float height = getNextSplit<float>(scaleStream, ',');
-                float length = getNextSplit<float>(scaleStream, ',');
+                    std::string_view emissive = getNextSplit(line, rest, '/');
+                    if (emissive != "true" && emissive != "false") fail(line, emissive, "expected true or false");
 
-                int material = getNextSplit<int>(lineStream, '/');
-                std::string tag = getNextSplit(lineStream, '/');
+                    materials.emplace_back(color, diffuse, glass, glassReflect, uvInfo, emissive == "true");
+                }
+                else if (readMode == BOX) {
+                    glm::vec3 position = getNextVector(line, rest);
+                    glm::vec3 scale = getNextVector(line, rest);
 
-                boxes.push_back(RTX::Box(glm::vec3(x, y, z), glm::vec3(width, height, length), material, tag.c_str()));
-            }
-            else {
-                std::stringstream positionStream = getNextStreamSplit(lineStream, '/');
+                    int material = getNextSplit<int>(line, rest, '/');
+                    std::string_view tag = getNextSplit(line, rest, '/');
 
-                float x = getNextSplit<float>(positionStream, ',');
-                float y = getNextSplit<float>(positionStream, ',');
-                float z = getNextSplit<float>(positionStream, ',');
+                    boxes.emplace_back(position, scale, material, Tags::intern(tag));
+                }
+                else {
+                    glm::vec3 position = getNextVector(line, rest);
+                    float radius = getNextSplit<float>(line, rest, '/');
 
-                float radius = getNextSplit<float>(lineStream, '/');
+                    int material = getNextSplit<int>(line, rest, '/');
+                    std::string_view tag = getNextSplit(line, rest, '/');
 
-                int material = getNextSplit<int>(lineStream, '/');
-                std::string tag = getNextSplit(lineStream, '/');
+                    spheres.emplace_back(position, radius, material, Tags::intern(tag));
+                }
 
-                spheres.push_back(RTX::Sphere(glm::vec3(x, y, z), radius, material, tag.c_str()));
+                expectEnd(line, rest, '/');
             }
         }
     }
+    catch (...) {
+        file.clear();
+        throw;
+    }
+
+    file.clear();
+
+    RTX::Map map(0, 0, 0, std::move(materials), std::move(boxes), std::move(spheres));
+    map.albedoLocation = albedoLocation;
+    map.normalLocation = normalLocation;
+    map.skyboxLocation = skyboxLocation;
 
-    return RTX::Map(albedoTexture, normalTexture, skyboxTexture, materials, boxes, spheres);
+    if (loadTextures) map.loadTextures();
+
+    return map;
 }
 
-template<typename T> T RTX::MapParser::parseString(std::string string) {
-    T result;
-    std::stringstream(string) >> result;
+std::string_view RTX::MapParser::getNextSplit(const Line& line, std::string_view& rest, char splitter) {
+    if (isConsumed(line, rest, splitter)) fail(line, rest, "missing field");
 
-    return result;
+    size_t end = rest.find(splitter);
+    std::string_view split = rest.substr(0, end);
+    rest.remove_prefix(end == std::string_view::npos ? rest.size() : end + 1);
+
+    while (!split.empty() && (split.front() == ' ' || split.front() == '\t')) split.remove_prefix(1);
+    while (!split.empty() && (split.back() == ' ' || split.back() == '\t')) split.remove_suffix(1);
+
+    return split;
 }
+template<typename T> T RTX::MapParser::getNextSplit(const Line& line, std::string_view& rest, char splitter) {
+    std::string_view split = getNextSplit(line, rest, splitter);
+
+    T result = T();
+    if constexpr (std::is_same_v<T, float>) {
+        if (parseShortFloat(split, result)) return result;
+    }
+
+    auto [end, error] = std::from_chars(split.data(), split.data() + split.size(), result);
 
-std::string RTX::MapParser::getNextSplit(std::stringstream& line, char splitter) {
-    std::string result;
-    std::getline(line, result, splitter);
+    if (split.empty() || error != std::errc() || end != split.data() + split.size())
+        fail(line, split, std::is_integral_v<T> ? "expected an integer" : "expected a number");
 
     return result;
 }
-std::stringstream RTX::MapParser::getNextStreamSplit(std::stringstream& line, char splitter) {
-    std::string split = getNextSplit(line, splitter);
-    return std::stringstream(split);
+glm::vec3 RTX::MapParser::getNextVector(const Line& line, std::string_view& rest) {
+    std::string_view field = getNextSplit(line, rest, '/');
+
+    glm::vec3 vector;
+    vector.x = getNextSplit<float>(line, field, ',');
+    vector.y = getNextSplit<float>(line, field, ',');
+    vector.z = getNextSplit<float>(line, field, ',');
+    expectEnd(line, field, ',');
+
+    return vector;
 }
 
-template<typename T> T RTX::MapParser::getNextSplit(std::stringstream& line, char splitter) {
-    return parseString<T>(getNextSplit(line, splitter));
+bool RTX::MapParser::parseShortFloat(std::string_view text, float& result) {
+    // Powers of ten up to 1e10 and integers up to 2^24 are exact floats, so their quotient rounds exactly like from_chars.
+    const static float powers[] = { 1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f };
+
+    const char* c = text.data();
+    const char* end = c + text.size();
+
+    bool negative = c != end && *c == '-';
+    if (negative) c++;
+
+    uint32_t mantissa = 0;
+    int digits = 0, decimals = -1;
+
+    for (; c != end; c++) {
+        if (*c == '.' && decimals < 0) decimals = 0;
+        else if (*c >= '0' && *c <= '9') {
+            mantissa = mantissa * 10 + (*c - '0');
+            if (mantissa > (1u << 24)) return false;
+
+            digits++;
+            if (decimals >= 0) decimals++;
+        }
+        else return false;
+    }
+
+    if (digits == 0 || decimals > 10) return false;
+
+    result = (float)mantissa / powers[glm::max(decimals, 0)];
+    if (negative) result = -result;
+
+    return true;
+}
+bool RTX::MapParser::isConsumed(const Line& line, std::string_view rest, char splitter) {
+    // An empty rest right after a splitter is still an empty field, "floor/" has two.
+    return rest.empty() && (rest.data() == line.text.data() || rest.data()[-1] != splitter);
+}
+void RTX::MapParser::expectEnd(const Line& line, std::string_view rest, char splitter) {
+    if (!isConsumed(line, rest, splitter)) fail(line, rest, "unexpected field");
+}
+void RTX::MapParser::fail(const Line& line, std::string_view at, const std::string& reason) {
+    size_t column = at.data() - line.text.data() + 1;
+    throw std::runtime_error(std::string(line.location) + ":" + std::to_string(line.number) + ":" + std::to_string(column) + ": " + reason);
 }
 
 float RTX::World::gravity = 25.0f;
 float* RTX::World::sunDirection = new float[3];
 
 RTX::Map* RTX::World::map = NULL;
+RTX::BVH* RTX::World::bvh = NULL;
+RTX::LightList* RTX::World::lights = NULL;
 
 void RTX::World::initialize(const char* mapName, float gravity, glm::vec3 sunDirection) {
-    map = new Map(MapParser::parse((std::string("res/maps/") + mapName + ".rtmap").c_str()));
+    std::string location = std::string("res/maps/") + mapName + ".rtmap";
+    std::string compiledLocation = location + "b";
+
+    bvh = new BVH();
+
+    // Compiled maps skip both the parser and the BVH build, see --compile.
+    if (MapFile::isCurrent(compiledLocation.c_str(), location.c_str())) map = new Map(MapFile::load(compiledLocation.c_str(), *bvh));
+    else {
+        map = new Map(MapParser::parse(location.c_str()));
+        bvh->build(map->boxes, map->spheres);
+    }
+
+    lights = new LightList();
+    lights->build(*map);
+
+    Renderer::uploadScene();
 
     World::gravity = gravity;
     World::sunDirection[0] = sunDirection.x;
@@ -148,11 +285,18 @@ void RTX::World::clear() {
     TT::Texture::clear(map->skyboxTexture);
 
     delete map;
+    delete bvh;
+    delete lights;
     delete[] sunDirection;
 }
 
 const float RTX::Player::onGroundResetDelay = 0.3f;
 const float RTX::Player::stepSpeed = 0.5f;
+const float RTX::Player::timeStep = 1.0f / 120.0f;
+const int RTX::Player::maxSubsteps = 30;
+const float RTX::Player::skinWidth = 0.001f;
+const int RTX::Player::laserTag = RTX::Tags::intern("laser");
+const int RTX::Player::jumpPadTag = RTX::Tags::intern("jump_pad");
 
 RTX::Player::Player(glm::vec3 position, glm::vec3 rotation, glm::vec3 scale) : stepSoundSource(TT::SoundSource()), stepSounds(new ALuint[3]), blyaSound(TT::AudioSystem::loadFromFile("res/sounds/blya.ogg")) {
     walkSpeed = 6.0f;
@@ -175,6 +319,7 @@ RTX::Player::Player(glm::vec3 position, glm::vec3 rotation, glm::vec3 scale) : s
 
     velocity = glm::vec3();
     startPosition = glm::vec3(position);
+    lastPosition = glm::vec3(position);
 
     stepSounds[0] = TT::AudioSystem::loadFromFile("res/sounds/player/step0.ogg");
     stepSounds[1] = TT::AudioSystem::loadFromFile("res/sounds/player/step1.ogg");
@@ -184,12 +329,58 @@ RTX::Player::Player(glm::vec3 position, glm::vec3 rotation, glm::vec3 scale) : s
 void RTX::Player::respawn() {
     velocity = glm::vec3();
     position = glm::vec3(startPosition);
+    lastPosition = glm::vec3(position);
 }
 void RTX::Player::update(TT::Time time) {
+    if (!cinematicMode) {
+        rotation.x -= TT::Mouse::getVelocity().y * rotateSpeed;
+        rotation.x = fmax(fmin(rotation.x, 89.99f), -89.99f);
+
+        rotation.y += TT::Mouse::getVelocity().x * rotateSpeed;
+        rotation.y -= floor(rotation.y / 360.0f) * 360.0f;
+    }
+    else {
+        rawRotation.x -= TT::Mouse::getVelocity().y * rotateSpeed;
+        rawRotation.x = fmax(fmin(rawRotation.x, 89.99f), -89.99f);
+        rawRotation.y += TT::Mouse::getVelocity().x * rotateSpeed;
+
+        rotation.x += (cinematicSharpness * time.getDelta()) * (rawRotation.x - rotation.x);
+        rotation.y += (cinematicSharpness * time.getDelta()) * (rawRotation.y - rotation.y);
+        rotation.z += (cinematicSharpness * time.getDelta()) * (rawRotation.z - rotation.z);
+    }
+
+    // Long frames drop the time past maxSubsteps, the world slows down instead of every later frame falling further behind.
+    stepAccumulator = glm::min(stepAccumulator + time.getDelta(), maxSubsteps * timeStep);
+
+    while (stepAccumulator >= timeStep) {
+        lastPosition = glm::vec3(position);
+        step(timeStep);
+
+        stepAccumulator -= timeStep;
+    }
+}
+void RTX::Player::clear() {
+    TT::AudioSystem::clear(stepSounds[0]);
+    TT::AudioSystem::clear(stepSounds[1]);
+    TT::AudioSystem::clear(stepSounds[2]);
+
+    stepSoundSource.stop();
+    stepSoundSource.clear();
+
+    delete[] stepSounds;
+}
+
+glm::vec3 RTX::Player::getEyePosition() {
+    // The camera trails the simulation by up to one step, blending the last two states so it moves every frame.
+    glm::vec3 position = glm::mix(lastPosition, this->position, stepAccumulator / timeStep);
+    return glm::vec3(position.x + scale.x / 2.0f, position.y + scale.y - eyeHeight, position.z + scale.z / 2.0f);
+}
+
+void RTX::Player::step(float delta) {
     velocity.x = 0.0f;
     velocity.z = 0.0f;
 
-    if (!flyMode) velocity.y -= World::gravity * time.getDelta();
+    if (!flyMode) velocity.y -= World::gravity * delta;
     else velocity.y = 0.0f;
 
     if (TT::Keyboard::isPressed(GLFW_KEY_W)) {
@@ -226,7 +417,7 @@ void RTX::Player::update(TT::Time time) {
     }
     else {
         if (onGroundResetDelayTimer >= onGroundResetDelay) onGround = false;
-        else onGroundResetDelayTimer += time.getDelta();
+        else onGroundResetDelayTimer += delta;
     }
 
     float horizontalLength = glm::length(glm::vec2(velocity.x, velocity.z));
@@ -238,109 +429,234 @@ void RTX::Player::update(TT::Time time) {
             if (stepTimer == 0.0f)
                 stepSoundSource.play(stepSounds[rand() % 3], 1.5f, 1.0f, false);
 
-            stepTimer += stepSpeed * time.getDelta();
+            stepTimer += stepSpeed * delta;
             if (stepTimer >= 1.0f / walkSpeed) stepTimer = 0.0f;
         }
         else stepTimer = 0.0f;
-
-        Renderer::resetDenoiser();
     }
 
-    std::vector<std::string> collidedTags;
-
     rawOnGround = false;
 
-    position.x += velocity.x * walkSpeed * time.getDelta();
-    collidedTags.push_back(checkCollision(World::map->boxes, World::map->spheres));
-
-    if (collidedTags[collidedTags.size() - 1] != "") {
-        position.x -= velocity.x * walkSpeed * time.getDelta();
-        velocity.x = 0.0f;
-    }
+    uint32_t touching = 0;
 
-    position.y += velocity.y * (flyMode ? walkSpeed : 1.0f) * time.getDelta();
-    collidedTags.push_back(checkCollision(World::map->boxes, World::map->spheres));
-
-    if (collidedTags[collidedTags.size() - 1] != "") {
-        position.y -= velocity.y * (flyMode ? walkSpeed : 1.0f) * time.getDelta();
+    if (move(0, velocity.x * walkSpeed * delta, touching)) velocity.x = 0.0f;
 
+    if (move(1, velocity.y * (flyMode ? walkSpeed : 1.0f) * delta, touching)) {
         if (velocity.y <= 0.0f) {
-            bool onJumpPad = std::find(collidedTags.begin(), collidedTags.end(), "jump_pad") != collidedTags.end();
+            bool onJumpPad = touching & Tags::getMask(jumpPadTag);
             velocity.y = onJumpPad ? 50.0f : 0.0f;
 
             if (!onJumpPad) rawOnGround = true;
             else blyaSoundSource.play(blyaSound, 0.8f, 1.0f, false);
         }
+        else velocity.y = 0.0f;
     }
 
-    position.z += velocity.z * walkSpeed * time.getDelta();
-    collidedTags.push_back(checkCollision(World::map->boxes, World::map->spheres));
+    if (move(2, velocity.z * walkSpeed * delta, touching)) velocity.z = 0.0f;
 
-    if (collidedTags[collidedTags.size() - 1] != "") {
-        position.z -= velocity.z * walkSpeed * time.getDelta();
-        velocity.z = 0.0f;
-    }
+    triggers.update(touching);
 
-    if (std::find(collidedTags.begin(), collidedTags.end(), "laser") != collidedTags.end())
+    if (triggers.getTouching() & Tags::getMask(laserTag))
         respawn();
+}
+bool RTX::Player::move(int axis, float distance, uint32_t& touching) {
+    if (distance == 0.0f) return false;
 
-    if (abs(velocity.y) > 0.1f) Renderer::resetDenoiser();
+    glm::vec3 motion(0.0f);
+    motion[axis] = distance;
 
-    glm::vec3 lastRotation = glm::vec3(rotation);
-    if (!cinematicMode) {
-        rotation.x -= TT::Mouse::getVelocity().y * rotateSpeed;
-        rotation.x = fmax(fmin(rotation.x, 89.99f), -89.99f);
+    SweepInfo sweep = this->sweep(motion);
+    touching |= sweep.tags;
 
-        rotation.y += TT::Mouse::getVelocity().x * rotateSpeed;
-        rotation.y -= floor(rotation.y / 360.0f) * 360.0f;
-    }
-    else {
-        rawRotation.x -= TT::Mouse::getVelocity().y * rotateSpeed;
-        rawRotation.x = fmax(fmin(rawRotation.x, 89.99f), -89.99f);
-        rawRotation.y += TT::Mouse::getVelocity().x * rotateSpeed;
+    // Stopping skinWidth short keeps the player off the surface, so sliding along a floor does not catch on the seam to the next box.
+    if (sweep.hit) position[axis] += distance * glm::max(sweep.time - skinWidth / glm::abs(distance), 0.0f);
+    else position[axis] += distance;
 
-        rotation.x += (cinematicSharpness * time.getDelta()) * (rawRotation.x - rotation.x);
-        rotation.y += (cinematicSharpness * time.getDelta()) * (rawRotation.y - rotation.y);
-        rotation.z += (cinematicSharpness * time.getDelta()) * (rawRotation.z - rotation.z);
+    return sweep.hit;
+}
+
+RTX::SweepInfo RTX::Player::sweep(glm::vec3 motion) {
+    Bounds bounds(position, position + scale);
+
+    Bounds swept(bounds);
+    swept.grow(Bounds(bounds.min + motion, bounds.max + motion));
+
+    collisionCandidates.clear();
+    World::bvh->query(swept, collisionCandidates);
+
+    int boxCount = (int)World::map->boxes.size();
+    SweepInfo result = { false, 1.0f, glm::vec3(0.0f), 0u };
+
+    for (int primitive : collisionCandidates) {
+        bool isBox = primitive < boxCount;
+
+        // Untagged primitives are scenery the player walks through.
+        if ((isBox ? World::map->boxes[primitive].tag : World::map->spheres[primitive - boxCount].tag) == 0) continue;
+
+        SweepInfo hit = isBox ? sweepBox(bounds, motion, World::map->boxes[primitive]) : sweepSphere(bounds, motion, World::map->spheres[primitive - boxCount]);
+        if (!hit.hit) continue;
+
+        // Contacts this close together are one, a laser flush with a floor still kills.
+        if (!result.hit || hit.time < result.time - 0.0001f) result = hit;
+        else if (hit.time <= result.time + 0.0001f) {
+            result.tags |= hit.tags;
+
+            if (hit.time < result.time) {
+                result.time = hit.time;
+                result.normal = hit.normal;
+            }
+        }
     }
 
-    if(abs(lastRotation.x - rotation.x) > 0.01f || abs(lastRotation.y - rotation.y) > 0.01f || abs(lastRotation.z - rotation.z) > 0.01f)
-        Renderer::resetDenoiser();
+    return result;
 }
-void RTX::Player::clear() {
-    TT::AudioSystem::clear(stepSounds[0]);
-    TT::AudioSystem::clear(stepSounds[1]);
-    TT::AudioSystem::clear(stepSounds[2]);
 
-    stepSoundSource.stop();
-    stepSoundSource.clear();
+RTX::SweepInfo RTX::Player::sweepBox(const Bounds& bounds, glm::vec3 motion, const Box& box) {
+    SweepInfo result = { false, 0.0f, glm::vec3(0.0f), 0u };
 
-    delete[] stepSounds;
-}
+    float enter = -INFINITY, exit = INFINITY;
+    int axis = -1;
 
-glm::vec3 RTX::Player::getEyePosition() {
-    return glm::vec3(position.x + scale.x / 2.0f, position.y + scale.y - eyeHeight, position.z + scale.z / 2.0f);
+    for (int i = 0; i < 3; i++) {
+        // Offsets along this axis that overlap the box, the ends only touch.
+        float low = box.position[i] - bounds.max[i];
+        float high = box.position[i] + box.scale[i] - bounds.min[i];
+
+        if (motion[i] == 0.0f) {
+            if (low >= 0.0f || high <= 0.0f) return result;
+            continue;
+        }
+
+        float near = (motion[i] > 0.0f ? low : high) / motion[i];
+        float far = (motion[i] > 0.0f ? high : low) / motion[i];
+
+        if (near > enter) {
+            enter = near;
+            axis = i;
+        }
+        exit = glm::min(exit, far);
+    }
+
+    if (axis < 0 || enter >= exit || enter > 1.0f || exit <= 0.0f) return result;
+
+    // Starting further inside than the skin lets the player walk out instead of sticking.
+    if (enter * glm::abs(motion[axis]) < -skinWidth) return result;
+
+    result.hit = true;
+    result.time = glm::max(enter, 0.0f);
+    result.normal[axis] = motion[axis] > 0.0f ? -1.0f : 1.0f;
+    result.tags = Tags::getMask(box.tag);
+
+    return result;
 }
+RTX::SweepInfo RTX::Player::sweepSphere(const Bounds& bounds, glm::vec3 motion, const Sphere& sphere) {
+    SweepInfo result = { false, 0.0f, glm::vec3(0.0f), 0u };
+
+    float speed = glm::length(motion);
+    if (speed == 0.0f) return result;
+
+    // Seen from the box the sphere centre travels against the motion, contact is that ray entering the box rounded by the radius.
+    glm::vec3 size = (bounds.max - bounds.min) * 0.5f;
+    glm::vec3 start = sphere.position - (bounds.min + bounds.max) * 0.5f;
+    glm::vec3 direction = -motion;
+
+    glm::vec3 offset = glm::clamp(start, -size, size) - start;
+    if (glm::length(offset) - sphere.radius < 0.0001f) {
+        if (glm::length(offset) - sphere.radius < -skinWidth || glm::dot(offset, motion) >= 0.0f) return result;
+
+        result.hit = true;
+        result.normal = glm::length(offset) > 0.0f ? glm::normalize(offset) : -motion / speed;
+        result.tags = Tags::getMask(sphere.tag);
+
+        return result;
+    }
 
-std::string RTX::Player::checkCollision(std::vector<Box> boxes, std::vector<Sphere> spheres) const {
-    for (Box& box : boxes)
-        if (position.x + scale.x >= box.position.x && position.x <= box.position.x + box.scale.x)
-            if (position.y + scale.y >= box.position.y && position.y <= box.position.y + box.scale.y)
-                if (position.z + scale.z >= box.position.z && position.z <= box.position.z + box.scale.z)
-                    return box.tag;
-    for (Sphere& sphere : spheres) {
-        glm::vec3 nearest(glm::max(glm::min(sphere.position.x, position.x + scale.x), position.x), glm::max(glm::min(sphere.position.y, position.y + scale.y), position.y), glm::max(glm::min(sphere.position.z, position.z + scale.z), position.z));
-        float length = glm::length(glm::vec3(sphere.position.x - nearest.x, sphere.position.y - nearest.y, sphere.position.z - nearest.z));
+    // The box grown by the radius bounds the rounded one, missing it misses everything.
+    float enter = -INFINITY, exit = INFINITY;
+    for (int i = 0; i < 3; i++) {
+        float extent = size[i] + sphere.radius;
 
-        if (length * length < sphere.radius * sphere.radius) return sphere.tag;
+        if (direction[i] == 0.0f) {
+            if (glm::abs(start[i]) >= extent) return result;
+            continue;
+        }
+
+        float near = (-extent - start[i]) / direction[i];
+        float far = (extent - start[i]) / direction[i];
+
+        enter = glm::max(enter, glm::min(near, far));
+        exit = glm::min(exit, glm::max(near, far));
     }
 
-    return "";
+    if (enter >= exit || enter > 1.0f || exit <= 0.0f) return result;
+
+    // A start already inside the grown box counts as entering it right away.
+    float time = glm::max(enter, 0.0f);
+
+    // Mirrored into the octant the grown box was entered from, so the nearest corner sits at size.
+    glm::vec3 mirror = glm::vec3(glm::greaterThanEqual(start + direction * time, glm::vec3(0.0f))) * 2.0f - 1.0f;
+    glm::vec3 origin = start * mirror;
+    glm::vec3 ray = direction * mirror;
+
+    glm::vec3 outside = glm::vec3(glm::greaterThan(origin + ray * time, size));
+
+    // Entering outside more than one face means the hit lies on a capsule around one of the three edges meeting at
+    // the corner, its far end can be in another octant.
+    if (outside.x + outside.y + outside.z > 1.0f) {
+        float a = glm::dot(ray, ray);
+        auto sweepCorner = [&](glm::vec3 corner) {
+            glm::vec3 relative = origin - corner;
+
+            float b = glm::dot(relative, ray);
+            float c = glm::dot(relative, relative) - sphere.radius * sphere.radius;
+            if (b * b - a * c <= 0.0f) return INFINITY;
+
+            float time = (-b - glm::sqrt(b * b - a * c)) / a;
+            return time > 0.0f ? time : INFINITY;
+        };
+
+        time = sweepCorner(size);
+
+        for (int i = 0; i < 3; i++) {
+            glm::vec3 end = size;
+            end[i] = -size[i];
+            time = glm::min(time, sweepCorner(end));
+
+            // The edge along axis i is a cylinder, so that axis drops out.
+            glm::vec3 relative = origin - size;
+            relative[i] = 0.0f;
+
+            glm::vec3 edgeRay = ray;
+            edgeRay[i] = 0.0f;
+
+            float edgeA = glm::dot(edgeRay, edgeRay);
+            float edgeB = glm::dot(relative, edgeRay);
+            float edgeC = glm::dot(relative, relative) - sphere.radius * sphere.radius;
+            if (edgeA <= 0.0f || edgeB * edgeB - edgeA * edgeC <= 0.0f) continue;
+
+            float edgeTime = (-edgeB - glm::sqrt(edgeB * edgeB - edgeA * edgeC)) / edgeA;
+            if (edgeTime > 0.0f && edgeTime < time && glm::abs(origin[i] + ray[i] * edgeTime) < size[i]) time = edgeTime;
+        }
+
+        if (time > 1.0f) return result;
+    }
+
+    glm::vec3 position = start + direction * time;
+    offset = glm::clamp(position, -size, size) - position;
+
+    result.hit = true;
+    result.time = time;
+    result.normal = glm::length(offset) > 0.0f ? glm::normalize(offset) : -motion / speed;
+    result.tags = Tags::getMask(sphere.tag);
+
+    return result;
 }
 
 float RTX::Camera::dofBlurSize = 0.05f;
 float RTX::Camera::dofFocusDistance = 12.0f;
 float RTX::Camera::fov = 90.0f;
+float RTX::Camera::exposure = 1.0f;
+int RTX::Camera::toneMapper = 0;
 
 void RTX::Camera::initialize(float dofBlurSize, float dofFocusDistance, float fov) {
     Camera::dofBlurSize = dofBlurSize;
@@ -349,27 +665,68 @@ void RTX::Camera::initialize(float dofBlurSize, float dofFocusDistance, float fo
 }
 
 TT::ShaderProgram* RTX::Renderer::raytraceProgram = NULL;
+TT::ShaderProgram* RTX::Renderer::denoiseProgram = NULL;
 TT::ShaderProgram* RTX::Renderer::screenProgram = NULL;
 
-TT::FrameBuffer* RTX::Renderer::firstFrameBuffer = NULL;
-TT::FrameBuffer* RTX::Renderer::secondFrameBuffer = NULL;
+std::vector<RTX::Renderer::FrameBufferSet> RTX::Renderer::frameBufferSets;
+TT::FrameBuffer* RTX::Renderer::lastFrameBuffer = NULL;
+
+TT::BufferTexture* RTX::Renderer::materialBuffer = NULL;
+TT::BufferTexture* RTX::Renderer::primitiveBuffer = NULL;
+TT::BufferTexture* RTX::Renderer::nodeBuffer = NULL;
+TT::BufferTexture* RTX::Renderer::lightBuffer = NULL;
 
 int RTX::Renderer::denoiserStep = 0;
+int RTX::Renderer::frameIndex = 0;
+bool RTX::Renderer::errorMipmapped = false;
+int RTX::Renderer::raysPerPixel = 8;
+int RTX::Renderer::maxBounces = 64;
+int RTX::Renderer::motionHistoryLimit = 1024;
+int RTX::Renderer::denoiseIterations = 4;
+bool RTX::Renderer::lightSampling = true;
+bool RTX::Renderer::adaptiveSampling = false;
+bool RTX::Renderer::heatMap = false;
+
+int RTX::Renderer::renderScale = 0;
+const std::vector<float> RTX::Renderer::renderScales = { 1.0f, 0.75f, 0.5f };
+
+RTX::View RTX::Renderer::view = {};
+TT::UniformBuffer* RTX::Renderer::cameraBuffer = NULL;
+
+glm::vec3 RTX::Renderer::lastEyePosition = glm::vec3(0.0f);
+glm::vec3 RTX::Renderer::lastRotation = glm::vec3(0.0f);
 
 void RTX::Renderer::initialize(glm::uvec2 size) {
     resize(size);
     reloadShaders();
+
+    cameraBuffer = new TT::UniformBuffer(sizeof(CameraBlock));
 }
+// Color keeps full floats for the exact sample count in alpha, so does variance for its running sample index and squared sun luminance.
+// The denoiser only filters HDR color and compares normals, distances and albedo, which half floats and bytes carry well enough.
 void RTX::Renderer::resize(glm::uvec2 size) {
     clearFrameBuffers();
 
-    firstFrameBuffer = new TT::FrameBuffer(size.x, size.y);
-    secondFrameBuffer = new TT::FrameBuffer(size.x, size.y);
+    const std::vector<GLint> formats = { GL_RGBA32F, GL_RGBA16F, GL_RGBA8, GL_RGBA32F };
+    for (float scale : renderScales) {
+        int width = glm::max((int)(size.x * scale), 1);
+        int height = glm::max((int)(size.y * scale), 1);
+
+        FrameBufferSet frameBufferSet;
+        frameBufferSet.first = new TT::FrameBuffer(width, height, formats);
+        frameBufferSet.second = new TT::FrameBuffer(width, height, formats);
+
+        frameBufferSet.denoise[0] = new TT::FrameBuffer(width, height, GL_RGBA16F);
+        frameBufferSet.denoise[1] = new TT::FrameBuffer(width, height, GL_RGBA16F);
+
+        frameBufferSets.push_back(frameBufferSet);
+    }
 }
 void RTX::Renderer::reloadShaders() {
     clearShaders();
 
     if (raytraceProgram) delete raytraceProgram;
+    if (denoiseProgram) delete denoiseProgram;
     if (screenProgram) delete screenProgram;
 
     raytraceProgram = new TT::ShaderProgram();
@@ -377,30 +734,128 @@ void RTX::Renderer::reloadShaders() {
     raytraceProgram->addShader(TT::Shader("res/shaders/raytrace.frag", GL_FRAGMENT_SHADER));
     raytraceProgram->compile();
 
+    // Buffer and 2D samplers may not share a texture unit, assign the units before validating.
+    raytraceProgram->load();
+    raytraceProgram->setUniform("backFrameSampler", 0);
+    raytraceProgram->setUniform("skyboxSampler", 1);
+    raytraceProgram->setUniform("albedoSampler", 2);
+    raytraceProgram->setUniform("normalSampler", 3);
+    raytraceProgram->setUniform("materialBuffer", 4);
+    raytraceProgram->setUniform("primitiveBuffer", 5);
+    raytraceProgram->setUniform("nodeBuffer", 6);
+    raytraceProgram->setUniform("backGeometrySampler", 7);
+    raytraceProgram->setUniform("lightBuffer", 8);
+    raytraceProgram->setUniform("backVarianceSampler", 9);
+    raytraceProgram->setUniformBlock("Camera", cameraBinding);
+    raytraceProgram->validate();
+
+    denoiseProgram = new TT::ShaderProgram();
+    denoiseProgram->addShader(TT::Shader("res/shaders/screen.vert", GL_VERTEX_SHADER));
+    denoiseProgram->addShader(TT::Shader("res/shaders/denoise.frag", GL_FRAGMENT_SHADER));
+    denoiseProgram->compile();
+
+    denoiseProgram->load();
+    denoiseProgram->setUniform("colorSampler", 0);
+    denoiseProgram->setUniform("geometrySampler", 1);
+    denoiseProgram->setUniform("albedoSampler", 2);
+    denoiseProgram->validate();
+
     screenProgram = new TT::ShaderProgram();
     screenProgram->addShader(TT::Shader("res/shaders/screen.vert", GL_VERTEX_SHADER));
     screenProgram->addShader(TT::Shader("res/shaders/screen.frag", GL_FRAGMENT_SHADER));
     screenProgram->compile();
+
+    screenProgram->load();
+    screenProgram->setUniform("colorSampler", 0);
+    screenProgram->setUniform("heatMapSampler", 1);
+    screenProgram->validate();
+
+    TT::ShaderProgram::unload();
+}
+void RTX::Renderer::uploadScene() {
+    clearScene();
+
+    std::vector<glm::vec4> materials, primitives, nodes, lights;
+    std::vector<int> bufferIndices(World::bvh->primitives.size());
+
+    for (const Material& material : World::map->materials) {
+        materials.push_back(glm::vec4(material.color, material.diffuse));
+        materials.push_back(glm::vec4(material.glass, material.glassReflect, material.emissive ? 1.0f : 0.0f, 0.0f));
+        materials.push_back(material.uvInfo);
+    }
+
+    // Primitives are stored in BVH order, so a leaf's range indexes this buffer directly.
+    int boxCount = (int)World::map->boxes.size();
+    for (int primitive : World::bvh->primitives) {
+        bufferIndices[primitive] = (int)primitives.size() / 2;
+
+        if (primitive < boxCount) {
+            const Box& box = World::map->boxes[primitive];
+
+            primitives.push_back(glm::vec4(box.position, (float)box.material));
+            primitives.push_back(glm::vec4(box.scale, 0.0f));
+        }
+        else {
+            const Sphere& sphere = World::map->spheres[primitive - boxCount];
+
+            primitives.push_back(glm::vec4(sphere.position, (float)sphere.material));
+            primitives.push_back(glm::vec4(sphere.radius, 0.0f, 0.0f, 1.0f));
+        }
+    }
+
+    for (const BVH::Node& node : World::bvh->nodes) {
+        nodes.push_back(glm::vec4(node.min, (float)node.leftFirst));
+        nodes.push_back(glm::vec4(node.max, (float)node.count));
+    }
+
+    for (const LightList::Light& light : World::lights->lights)
+        lights.push_back(glm::vec4((float)bufferIndices[light.primitive], light.probability, (float)light.alias, 0.0f));
+
+    // Maps without lights still bind a one texel buffer, lightCount keeps the shader from reading it.
+    if (lights.empty()) lights.push_back(glm::vec4(0.0f));
+
+    materialBuffer = new TT::BufferTexture(materials.data(), materials.size() * sizeof(glm::vec4), GL_RGBA32F);
+    primitiveBuffer = new TT::BufferTexture(primitives.data(), primitives.size() * sizeof(glm::vec4), GL_RGBA32F);
+    nodeBuffer = new TT::BufferTexture(nodes.data(), nodes.size() * sizeof(glm::vec4), GL_RGBA32F);
+    lightBuffer = new TT::BufferTexture(lights.data(), lights.size() * sizeof(glm::vec4), GL_RGBA32F);
 }
 void RTX::Renderer::resetDenoiser() {
     denoiserStep = 1;
+    frameIndex = 0;
+
+    errorMipmapped = false;
+}
+
+void RTX::Renderer::render(TT::TripleBuffer<View>& views) {
+    TT::FrameBuffer* renderFrameBuffer = raytrace(views);
+    present(denoise(renderFrameBuffer), renderFrameBuffer);
+
+    lastEyePosition = view.eyePosition;
+    lastRotation = view.rotation;
+    lastFrameBuffer = renderFrameBuffer;
+
+    denoiserStep++;
+    frameIndex++;
 }
+TT::FrameBuffer* RTX::Renderer::raytrace(TT::TripleBuffer<View>& views) {
+    TT::Profiler::Scope scope("Raytrace", true);
 
-void RTX::Renderer::render(TT::Time time, Player player) {
-    bool denoiserSwapState = denoiserStep % 2 == 0;
+    renderScale = glm::clamp(renderScale, 0, (int)renderScales.size() - 1);
+    const FrameBufferSet& frameBufferSet = getFrameBufferSet(renderScale);
 
-    TT::FrameBuffer* renderFrameBuffer = denoiserSwapState ? firstFrameBuffer : secondFrameBuffer;
-    TT::FrameBuffer* backFrameBuffer = denoiserSwapState ? secondFrameBuffer : firstFrameBuffer;
+    // Reprojection samples by uv, so the history may come from another scale's buffer right after the governor switched.
+    TT::FrameBuffer* renderFrameBuffer = lastFrameBuffer == frameBufferSet.first ? frameBufferSet.second : frameBufferSet.first;
+    TT::FrameBuffer* backFrameBuffer = lastFrameBuffer ? lastFrameBuffer : (renderFrameBuffer == frameBufferSet.first ? frameBufferSet.second : frameBufferSet.first);
 
+    glDisable(GL_BLEND);
     renderFrameBuffer->load();
 
     raytraceProgram->load();
-    raytraceProgram->setUniform("playerPosition", player.getEyePosition());
-    raytraceProgram->setUniform("playerRotation", player.rotation);
     raytraceProgram->setUniform("sunDirection", glm::vec3(World::sunDirection[0], World::sunDirection[1], World::sunDirection[2]));
     raytraceProgram->setUniform("screenResolution", TT::Window::getSize());
-    raytraceProgram->setUniform("random", time.getTime());
-    raytraceProgram->setUniform("backFrameFactor", 1.0f / denoiserStep);
+    raytraceProgram->setUniform("frameIndex", frameIndex);
+    raytraceProgram->setUniform("resetBackFrame", (int)(denoiserStep <= 1));
+    raytraceProgram->setUniform("lightSampling", (int)lightSampling);
     raytraceProgram->setUniform("backFrameSampler", 0);
     raytraceProgram->setUniform("skyboxSampler", 1);
     raytraceProgram->setUniform("albedoSampler", 2);
@@ -408,37 +863,19 @@ void RTX::Renderer::render(TT::Time time, Player player) {
     raytraceProgram->setUniform("dofFocusDistance", Camera::dofFocusDistance);
     raytraceProgram->setUniform("dofBlurSize", Camera::dofBlurSize);
     raytraceProgram->setUniform("fov", Camera::fov);
-
-    for (int i = 0; i < World::map->boxes.size(); i++) {
-        Box box = World::map->boxes[i];
-        Material material = World::map->materials[box.material];
-
-        std::string uniformId = "boxes[" + std::to_string(i) + ']';
-
-        raytraceProgram->setUniform((uniformId + ".position").c_str(), box.position);
-        raytraceProgram->setUniform((uniformId + ".size").c_str(), box.scale);
-        raytraceProgram->setUniform((uniformId + ".material.color").c_str(), material.color);
-        raytraceProgram->setUniform((uniformId + ".material.diffuse").c_str(), material.diffuse);
-        raytraceProgram->setUniform((uniformId + ".material.glass").c_str(), material.glass);
-        raytraceProgram->setUniform((uniformId + ".material.glassReflectivity").c_str(), material.glassReflect);
-        raytraceProgram->setUniform((uniformId + ".material.uvInfo").c_str(), material.uvInfo);
-        raytraceProgram->setUniform((uniformId + ".material.emissive").c_str(), material.emissive ? 1 : 0);
-    }
-    for (int i = 0; i < World::map->spheres.size(); i++) {
-        Sphere sphere = World::map->spheres[i];
-        Material material = World::map->materials[sphere.material];
-
-        std::string uniformId = "spheres[" + std::to_string(i) + ']';
-
-        raytraceProgram->setUniform((uniformId + ".position").c_str(), sphere.position);
-        raytraceProgram->setUniform((uniformId + ".radius").c_str(), sphere.radius);
-        raytraceProgram->setUniform((uniformId + ".material.color").c_str(), material.color);
-        raytraceProgram->setUniform((uniformId + ".material.diffuse").c_str(), material.diffuse);
-        raytraceProgram->setUniform((uniformId + ".material.glass").c_str(), material.glass);
-        raytraceProgram->setUniform((uniformId + ".material.glassReflect").c_str(), material.glassReflect);
-        raytraceProgram->setUniform((uniformId + ".material.uvInfo").c_str(), material.uvInfo);
-        raytraceProgram->setUniform((uniformId + ".material.emissive").c_str(), material.emissive ? 1 : 0);
-    }
+    raytraceProgram->setUniform("materialBuffer", 4);
+    raytraceProgram->setUniform("primitiveBuffer", 5);
+    raytraceProgram->setUniform("nodeBuffer", 6);
+    raytraceProgram->setUniform("backGeometrySampler", 7);
+    raytraceProgram->setUniform("lightBuffer", 8);
+    raytraceProgram->setUniform("nodeCount", (int)World::bvh->nodes.size());
+    raytraceProgram->setUniform("lightCount", (int)World::lights->lights.size());
+    raytraceProgram->setUniform("lightPower", World::lights->power);
+    raytraceProgram->setUniform("backVarianceSampler", 9);
+    raytraceProgram->setUniform("raysPerPixel", raysPerPixel);
+    raytraceProgram->setUniform("maxBounces", maxBounces);
+    raytraceProgram->setUniform("adaptiveSampling", (int)(adaptiveSampling && errorMipmapped));
+    raytraceProgram->setUniform("errorLevel", (int)glm::log2((float)glm::max(backFrameBuffer->getWidth(), backFrameBuffer->getHeight())));
 
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, backFrameBuffer->getTexture());
@@ -452,64 +889,234 @@ void RTX::Renderer::render(TT::Time time, Player player) {
     glActiveTexture(GL_TEXTURE3);
     glBindTexture(GL_TEXTURE_2D, World::map->normalTexture);
 
-    glBegin(GL_QUADS);
-    glVertex2i(-1, -1);
-    glVertex2i(1, -1);
-    glVertex2i(1, 1);
-    glVertex2i(-1, 1);
-    glEnd();
+    materialBuffer->load(4);
+    primitiveBuffer->load(5);
+    nodeBuffer->load(6);
+    lightBuffer->load(8);
+
+    glActiveTexture(GL_TEXTURE7);
+    glBindTexture(GL_TEXTURE_2D, backFrameBuffer->getTexture(1));
+
+    glActiveTexture(GL_TEXTURE9);
+    glBindTexture(GL_TEXTURE_2D, backFrameBuffer->getTexture(3));
+
+    // The camera is latched last, everything above was set up with whatever pose was current then.
+    views.update();
+    view = views.getReadBuffer();
+
+    bool cameraMoved = view.eyePosition != lastEyePosition || view.rotation != lastRotation;
+    raytraceProgram->setUniform("historyLimit", cameraMoved ? (float)motionHistoryLimit : INFINITY);
+
+    CameraBlock camera = { glm::vec4(view.eyePosition, 0.0f), glm::vec4(view.rotation, 0.0f), glm::vec4(lastEyePosition, 0.0f), glm::vec4(lastRotation, 0.0f) };
+    cameraBuffer->update(&camera, cameraBinding);
+
+    renderQuad();
+
+    // The last mip level averages the relative error over the screen, next frame scales its budget against it.
+    if (adaptiveSampling) renderFrameBuffer->generateMipmaps(3);
+    errorMipmapped = adaptiveSampling;
+
+    return renderFrameBuffer;
+}
+TT::FrameBuffer* RTX::Renderer::denoise(TT::FrameBuffer* frameBuffer) {
+    TT::Profiler::Scope scope("Denoise", true);
+    if (denoiseIterations <= 0) return frameBuffer;
+
+    denoiseProgram->load();
+    denoiseProgram->setUniform("raysPerPixel", raysPerPixel);
+
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, frameBuffer->getTexture(1));
+
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, frameBuffer->getTexture(2));
+
+    // A-trous wavelet: the same 5x5 kernel is applied with holes doubling every pass.
+    TT::FrameBuffer* source = frameBuffer;
+    for (int i = 0; i < denoiseIterations; i++) {
+        TT::FrameBuffer* target = getFrameBufferSet(renderScale).denoise[i % 2];
+        target->load();
+
+        denoiseProgram->setUniform("stepSize", 1 << i);
+        denoiseProgram->setUniform("demodulate", (int)(i == 0));
+        denoiseProgram->setUniform("remodulate", (int)(i == denoiseIterations - 1));
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, source->getTexture());
+
+        renderQuad();
+        source = target;
+    }
+
+    return source;
+}
+void RTX::Renderer::present(TT::FrameBuffer* resolvedFrameBuffer, TT::FrameBuffer* frameBuffer) {
+    TT::Profiler::Scope scope("Screen", true);
 
     TT::FrameBuffer::unload();
+    glEnable(GL_BLEND);
 
     screenProgram->load();
     screenProgram->setUniform("screenResolution", TT::Window::getSize());
-    screenProgram->setUniform("textureResolution", glm::vec2(renderFrameBuffer->getWidth(), renderFrameBuffer->getHeight()));
+    screenProgram->setUniform("textureResolution", glm::vec2(frameBuffer->getWidth(), frameBuffer->getHeight()));
+    screenProgram->setUniform("exposure", Camera::exposure);
+    screenProgram->setUniform("toneMapper", Camera::toneMapper);
+    screenProgram->setUniform("heatMap", (int)heatMap);
+    screenProgram->setUniform("maxSamples", (float)(adaptiveSampling ? raysPerPixel * ADAPTIVE_SAMPLE_LIMIT : raysPerPixel));
+    screenProgram->setUniform("colorSampler", 0);
+    screenProgram->setUniform("heatMapSampler", 1);
 
     glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, renderFrameBuffer->getTexture());
+    glBindTexture(GL_TEXTURE_2D, resolvedFrameBuffer->getTexture());
+
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, frameBuffer->getTexture(3));
+
+    renderQuad();
 
+    TT::ShaderProgram::unload();
+    TT::Texture::unload();
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+void RTX::Renderer::renderQuad() {
     glBegin(GL_QUADS);
     glVertex2i(-1, -1);
     glVertex2i(1, -1);
     glVertex2i(1, 1);
     glVertex2i(-1, 1);
     glEnd();
-
-    TT::ShaderProgram::unload();
-    TT::Texture::unload();
-
-    glBindTexture(GL_TEXTURE_2D, 0);
-
-    denoiserStep++;
 }
 void RTX::Renderer::clear() {
     clearShaders();
+    clearFrameBuffers();
+    clearScene();
+
+    if (cameraBuffer) {
+        cameraBuffer->clear();
+        delete cameraBuffer;
+
+        cameraBuffer = NULL;
+    }
 }
 void RTX::Renderer::clearShaders() {
     if(raytraceProgram) raytraceProgram->clear();
+    if(denoiseProgram) denoiseProgram->clear();
     if(screenProgram) screenProgram->clear();
 }
 void RTX::Renderer::clearFrameBuffers() {
-    if (firstFrameBuffer) {
-        firstFrameBuffer->clear();
-        delete firstFrameBuffer;
+    for (const FrameBufferSet& frameBufferSet : frameBufferSets) {
+        for (TT::FrameBuffer* frameBuffer : { frameBufferSet.first, frameBufferSet.second, frameBufferSet.denoise[0], frameBufferSet.denoise[1] }) {
+            frameBuffer->clear();
+            delete frameBuffer;
+        }
     }
-    if (secondFrameBuffer) {
-        secondFrameBuffer->clear();
-        delete secondFrameBuffer;
+
+    frameBufferSets.clear();
+    lastFrameBuffer = NULL;
+    errorMipmapped = false;
+}
+
+void RTX::Renderer::clearScene() {
+    for (TT::BufferTexture** buffer : { &materialBuffer, &primitiveBuffer, &nodeBuffer, &lightBuffer }) {
+        if (!*buffer) continue;
+
+        (*buffer)->clear();
+        delete *buffer;
+        *buffer = NULL;
     }
 }
 
 TT::FrameBuffer* RTX::Renderer::getFirstFrameBuffer() {
-    return firstFrameBuffer;
+    return getFrameBufferSet(renderScale).first;
 }
 TT::FrameBuffer* RTX::Renderer::getSecondFrameBuffer() {
-    return secondFrameBuffer;
+    return getFrameBufferSet(renderScale).second;
+}
+TT::FrameBuffer* RTX::Renderer::getLastFrameBuffer() {
+    return lastFrameBuffer ? lastFrameBuffer : getFrameBufferSet(renderScale).second;
+}
+const RTX::Renderer::FrameBufferSet& RTX::Renderer::getFrameBufferSet(int scale) {
+    return frameBufferSets[scale];
+}
+const RTX::View& RTX::Renderer::getView() {
+    return view;
+}
+
+bool RTX::Governor::enabled = false;
+float RTX::Governor::targetFrameTime = 16.6f;
+int RTX::Governor::maxRaysPerPixel = 32;
+
+float RTX::Governor::frameTime = 0.0f;
+int RTX::Governor::cooldown = 0;
+
+const static int governorMinBounces = 4;
+const static int governorMaxBounces = 64;
+const static int governorCooldown = 10;
+
+void RTX::Governor::update(float cpuTime, float gpuTime) {
+    // GPU time ignores vertical sync and swap waits, the CPU delta only stands in until the first query comes back.
+    float sample = gpuTime > 0.0f ? gpuTime : cpuTime;
+    frameTime = frameTime > 0.0f ? glm::mix(frameTime, sample, 0.2f) : sample;
+
+    if (!enabled || cooldown-- > 0) return;
+
+    float ratio = targetFrameTime / frameTime;
+    bool changed = false;
+
+    if (ratio < 0.9f) changed = degrade(ratio);
+    else if (ratio > 1.2f) changed = improve(ratio);
+
+    // The timer answers a few frames late, a change has to show up in the average before the next one.
+    if (changed) cooldown = governorCooldown;
+}
+bool RTX::Governor::degrade(float ratio) {
+    if (Renderer::raysPerPixel > 1) {
+        Renderer::raysPerPixel = glm::clamp((int)(Renderer::raysPerPixel * ratio), 1, Renderer::raysPerPixel - 1);
+        return true;
+    }
+    if (Renderer::maxBounces > governorMinBounces) {
+        Renderer::maxBounces = glm::max(Renderer::maxBounces / 2, governorMinBounces);
+        return true;
+    }
+    if (Renderer::renderScale < (int)Renderer::renderScales.size() - 1) {
+        Renderer::renderScale++;
+        return true;
+    }
+
+    return false;
+}
+bool RTX::Governor::improve(float ratio) {
+    // Cost grows with the pixel count, a larger scale is only taken when the headroom covers it.
+    if (Renderer::renderScale > 0) {
+        float scaleGrowth = Renderer::renderScales[Renderer::renderScale - 1] / Renderer::renderScales[Renderer::renderScale];
+        if (ratio < scaleGrowth * scaleGrowth * 1.1f) return false;
+
+        Renderer::renderScale--;
+        return true;
+    }
+    if (Renderer::maxBounces < governorMaxBounces) {
+        Renderer::maxBounces = glm::min(Renderer::maxBounces * 2, governorMaxBounces);
+        return true;
+    }
+    if (Renderer::raysPerPixel < maxRaysPerPixel) {
+        Renderer::raysPerPixel = glm::clamp((int)(Renderer::raysPerPixel * ratio / 1.1f), Renderer::raysPerPixel + 1, maxRaysPerPixel);
+        return true;
+    }
+
+    return false;
+}
+
+float RTX::Governor::getFrameTime() {
+    return frameTime;
 }
 
 bool RTX::DebugHud::frameScaleMode = false;
 int RTX::DebugHud::frameScale = 1;
 
+float RTX::DebugHud::tracerError = -1.0f;
+bool RTX::DebugHud::traceSaved = false;
+
 void RTX::DebugHud::initialize() {
     frameScaleMode = false;
     frameScale = 1;
@@ -550,6 +1157,11 @@ void RTX::DebugHud::render(Player& player) {
     if (ImGui::DragFloat("Fov", &Camera::fov, 1.0f, 20.0f, 179.0f))
         Renderer::resetDenoiser();
 
+    ImGui::Spacing();
+
+    ImGui::DragFloat("Exposure", &Camera::exposure, 0.005f, 0.01f, 16.0f);
+    ImGui::Combo("Tone Mapping", &Camera::toneMapper, "Clamp\0Reinhard\0ACES\0");
+
     ImGui::Separator();
     ImGui::Text("Graphics");
 
@@ -572,8 +1184,72 @@ void RTX::DebugHud::render(Player& player) {
         Renderer::resetDenoiser();
     }
 
+    if (ImGui::InputInt("Rays Per Pixel", &Renderer::raysPerPixel))
+        Renderer::raysPerPixel = glm::clamp(Renderer::raysPerPixel, 1, 256);
+    if (ImGui::InputInt("Denoise Iterations", &Renderer::denoiseIterations))
+        Renderer::denoiseIterations = glm::clamp(Renderer::denoiseIterations, 0, 8);
+    if (ImGui::InputInt("Max Bounces", &Renderer::maxBounces))
+        Renderer::maxBounces = glm::clamp(Renderer::maxBounces, 1, 64);
+    ImGui::Checkbox("Light Sampling", &Renderer::lightSampling);
+    if (ImGui::Checkbox("Adaptive Sampling", &Renderer::adaptiveSampling)) Renderer::resetDenoiser();
+    ImGui::Checkbox("Sample Heat Map", &Renderer::heatMap);
+
+    ImGui::Spacing();
+
+    ImGui::Checkbox("Frame Time Governor", &Governor::enabled);
+    ImGui::DragFloat("Target Frame Time", &Governor::targetFrameTime, 0.1f, 4.0f, 100.0f, "%.1f ms");
+    if (ImGui::InputInt("Governor Max Rays", &Governor::maxRaysPerPixel))
+        Governor::maxRaysPerPixel = glm::clamp(Governor::maxRaysPerPixel, 1, 256);
+    ImGui::SliderInt("Render Scale", &Renderer::renderScale, 0, (int)Renderer::renderScales.size() - 1, "");
+    ImGui::Text("%.1f ms (GPU %.1f ms) at %d%% scale", Governor::getFrameTime(), TT::Profiler::getGpuTime(), (int)(Renderer::renderScales[Renderer::renderScale] * 100.0f));
+
+    if (ImGui::InputInt("Motion History Samples", &Renderer::motionHistoryLimit, 128))
+        Renderer::motionHistoryLimit = glm::max(Renderer::motionHistoryLimit, 0);
+
     if (ImGui::Button("Reload Shaders")) Renderer::reloadShaders();
 
+    ImGui::Separator();
+    ImGui::Text("CPU Reference");
+
+    if (ImGui::InputInt("CPU Rays Per Pixel", &Tracer::raysPerPixel))
+        Tracer::raysPerPixel = glm::clamp(Tracer::raysPerPixel, 1, 1024);
+
+    if (ImGui::Button("Render CPU Reference")) {
+        TT::FrameBuffer* frameBuffer = Renderer::getLastFrameBuffer();
+        glm::uvec2 size(frameBuffer->getWidth(), frameBuffer->getHeight());
+
+        if (Tracer::getSize() != size) Tracer::resize(size);
+        Tracer::lightSampling = Renderer::lightSampling;
+        Tracer::maxBounces = Renderer::maxBounces;
+        Tracer::resetDenoiser();
+        Tracer::render(player.getEyePosition(), player.rotation);
+
+        tracerError = Tracer::compare(frameBuffer->readPixels());
+    }
+
+    if (tracerError >= 0.0f) {
+        ImGui::Text("RMSE vs GPU: %.4f", tracerError);
+        ImGui::Text("%.2f Mrays/s on %u threads (%.2f s)", Tracer::getRaysPerSecond() / 1000000.0, TT::ThreadPool::getThreadCount(), Tracer::getFrameTime());
+    }
+
+    ImGui::Separator();
+    ImGui::Text("Profiler");
+
+    char frameTimeText[32];
+    snprintf(frameTimeText, sizeof(frameTimeText), "%.1f ms", TT::Profiler::getFrameTime());
+    ImGui::PlotLines("Frame Time", TT::Profiler::getFrameHistory(), TT::Profiler::historySize, TT::Profiler::getHistoryOffset(), frameTimeText, 0.0f, FLT_MAX, ImVec2(0.0f, 60.0f));
+
+    for (const TT::Profiler::Section& section : TT::Profiler::getSections()) {
+        if (section.gpuTimer) ImGui::Text("%-10s CPU %6.2f ms  GPU %6.2f ms", section.name.c_str(), section.cpuTime, section.gpuTime);
+        else ImGui::Text("%-10s CPU %6.2f ms", section.name.c_str(), section.cpuTime);
+    }
+
+    if (ImGui::Button("Save Trace")) traceSaved = TT::Profiler::saveTrace("trace.json");
+    if (traceSaved) {
+        ImGui::SameLine();
+        ImGui::Text("trace.json, open in chrome://tracing");
+    }
+
     ImGui::End();
 }
 
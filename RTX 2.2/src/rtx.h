@@ -1,8 +1,13 @@
 #pragma once
+#include <cstdint>
+#include <map>
+#include <string_view>
 #include "engine/graphics.h"
 #include "engine/input.h"
 #include "engine/math.h"
 #include "engine/audio.h"
+#include "engine/profiler.h"
+#include "engine/threading.h"
 
 namespace RTX {
     struct Material {
@@ -19,23 +24,47 @@ namespace RTX {
         Material(glm::vec3 color, float diffuse, float glass, float glassReflect, glm::vec4 uvInfo, bool emissive);
     };
 
+    // Gameplay tags interned to small ids while maps load, so physics compares and combines them as bits.
+    // Id 0 is the empty tag, which never collides. Ids past the mask width still load but have no bit,
+    // the tags physics asks for are interned at startup and always get one.
+    class Tags {
+    public:
+        static const int maskBits = 32;
+
+        static int intern(std::string_view name);
+
+        static const std::string& getName(int tag);
+        static uint32_t getMask(int tag);
+    private:
+        static std::vector<std::string> names;
+        static std::map<std::string, int, std::less<>> ids;
+    };
+
+    // What a body touches, split into the tags it started, kept and stopped touching since the last update.
+    struct Triggers {
+        uint32_t enter = 0, stay = 0, exit = 0;
+
+        void update(uint32_t touching);
+        uint32_t getTouching() const;
+    };
+
     struct Box {
         glm::vec3 position;
         glm::vec3 scale;
 
         int material;
-        std::string tag;
+        int tag;
 
-        Box(glm::vec3 position, glm::vec3 scale, int material, std::string tag);
+        Box(glm::vec3 position, glm::vec3 scale, int material, int tag);
     };
     struct Sphere {
         glm::vec3 position;
         float radius;
 
         int material;
-        std::string tag;
+        int tag;
 
-        Sphere(glm::vec3 position, float radius, int material, std::string tag);
+        Sphere(glm::vec3 position, float radius, int material, int tag);
     };
 
     struct Map {
@@ -44,43 +73,82 @@ namespace RTX {
         std::vector<Sphere> spheres;
 
         int albedoTexture, normalTexture, skyboxTexture;
+        std::string albedoLocation, normalLocation, skyboxLocation;
 
         Map(
             int albedoTexture, int normalTexture, int skyboxTexture,
             std::vector<Material> materials, std::vector<Box> boxes, std::vector<Sphere> spheres
         );
+
+        // Starts loading the three textures, they show flat placeholders until TT::Texture::update swaps them in.
+        void loadTextures();
     };
+    struct Bounds;
+    class BVH;
+    class LightList;
+
+    // Single pass over the mapped file, fields are views into it and numbers are read with from_chars.
+    // Errors are reported as "location:line:column: reason".
     class MapParser {
     public:
-        static Map parse(const char* location);
+        static Map parse(const char* location, bool loadTextures = true);
     private:
         enum ReadMode {
             INFO, MATERIAL, BOX, SPHERE
         };
 
-        template<typename T> static T parseString(std::string string);
+        struct Line {
+            const char* location;
+            int number;
 
-        static std::string getNextSplit(std::stringstream& line, char splitter);
-        static std::stringstream getNextStreamSplit(std::stringstream& line, char splitter);
+            std::string_view text;
+        };
+
+        static std::string_view getNextSplit(const Line& line, std::string_view& rest, char splitter);
+        template<typename T> static T getNextSplit(const Line& line, std::string_view& rest, char splitter);
+        static glm::vec3 getNextVector(const Line& line, std::string_view& rest);
+        // Plain decimals with few digits, where a single float division is exact. Anything else is left to from_chars.
+        static bool parseShortFloat(std::string_view text, float& result);
 
-        template<typename T> static T getNextSplit(std::stringstream& line, char splitter);
+        static bool isConsumed(const Line& line, std::string_view rest, char splitter);
+        static void expectEnd(const Line& line, std::string_view rest, char splitter);
+        [[noreturn]] static void fail(const Line& line, std::string_view at, const std::string& reason);
     };
     struct World {
         static float gravity;
         static float* sunDirection;
 
         static Map* map;
+        static BVH* bvh;
+        static LightList* lights;
 
         static void initialize(const char* mapName, float gravity, glm::vec3 sunDirection);
         static void clear();
     };
 
+    // First contact of a moving box, time is the fraction of the motion travelled and the normal points back at the mover.
+    // Tags holds every primitive touched at that time.
+    struct SweepInfo {
+        bool hit;
+
+        float time;
+        glm::vec3 normal;
+
+        uint32_t tags;
+    };
+
+    // Movement and collision advance in fixed steps of timeStep, so jump height and collision do not depend on the frame rate.
+    // Moves are swept against the scene, a fast fall stops on a thin platform however far one step carries it.
+    // Looking around stays per frame.
     class Player {
     public:
+        const static float timeStep;
+
         float walkSpeed, rotateSpeed, jumpHeight, eyeHeight, cinematicSharpness;
         glm::vec3 position, rawRotation, rotation, scale, velocity;
 
         bool flyMode, cinematicMode;
+        Triggers triggers;
 
         Player(glm::vec3 position, glm::vec3 rotation, glm::vec3 scale);
 
@@ -89,8 +157,14 @@ namespace RTX {
         void clear();
 
         glm::vec3 getEyePosition();
+
+        static SweepInfo sweepBox(const Bounds& bounds, glm::vec3 motion, const Box& box);
+        static SweepInfo sweepSphere(const Bounds& bounds, glm::vec3 motion, const Sphere& sphere);
     private:
         const static float onGroundResetDelay, stepSpeed;
+        const static int maxSubsteps;
+        const static float skinWidth;
+        const static int laserTag, jumpPadTag;
 
         ALuint* const stepSounds;
         const ALuint blyaSound;
@@ -101,36 +175,121 @@ namespace RTX {
         bool rawOnGround = false, onGround = false;
         float onGroundResetDelayTimer, stepTimer;
 
-        glm::vec3 startPosition;
+        glm::vec3 startPosition, lastPosition;
+        float stepAccumulator = 0.0f;
+
+        // Reused between queries so a sweep never allocates.
+        std::vector<int> collisionCandidates;
+
+        void step(float delta);
+        bool move(int axis, float distance, uint32_t& touching);
+
+        SweepInfo sweep(glm::vec3 motion);
+    };
+
+    // The camera as one simulation tick left it, published to the render thread and never changed afterwards.
+    struct View {
+        glm::vec3 eyePosition, rotation;
+        bool grabbed;
 
-        std::string checkCollision(std::vector<Box> boxes, std::vector<Sphere> spheres) const;
+        // When the input behind this view was polled, in glfwGetTime seconds.
+        double inputTime;
     };
 
     struct Camera {
         static float dofBlurSize, dofFocusDistance, fov;
+        static float exposure;
+        static int toneMapper;
+
         static void initialize(float dofBlurSize, float dofFocusDistance, float fov);
     };
 
     class Renderer {
     public:
+        static int raysPerPixel;
+        static int maxBounces;
+        static int motionHistoryLimit;
+        static int denoiseIterations;
+        static bool lightSampling;
+        static bool adaptiveSampling;
+        static bool heatMap;
+
+        static int renderScale;
+        static const std::vector<float> renderScales;
+
         static void initialize(glm::uvec2 size);
         static void resize(glm::uvec2 size);
         static void reloadShaders();
+        static void uploadScene();
 
-        static void render(TT::Time time, Player player);
+        // Takes the newest view right before the raytrace draw is submitted.
+        static void render(TT::TripleBuffer<View>& views);
         static void clear();
         static void clearShaders();
         static void clearFrameBuffers();
+        static void clearScene();
 
         static TT::FrameBuffer* getFirstFrameBuffer();
         static TT::FrameBuffer* getSecondFrameBuffer();
+        static TT::FrameBuffer* getLastFrameBuffer();
+        // The view the last frame was drawn from.
+        static const View& getView();
 
         static void resetDenoiser();
     private:
-        static TT::ShaderProgram *raytraceProgram, *screenProgram;
-        static TT::FrameBuffer *firstFrameBuffer, *secondFrameBuffer;
+        // One set per render scale, allocated up front so switching scales never reallocates.
+        struct FrameBufferSet {
+            TT::FrameBuffer *first, *second;
+            TT::FrameBuffer *denoise[2];
+        };
+        static const FrameBufferSet& getFrameBufferSet(int scale);
+
+        static TT::ShaderProgram *raytraceProgram, *denoiseProgram, *screenProgram;
+        static std::vector<FrameBufferSet> frameBufferSets;
+        static TT::FrameBuffer* lastFrameBuffer;
+        static TT::BufferTexture *materialBuffer, *primitiveBuffer, *nodeBuffer, *lightBuffer;
+
+        // Matches the std140 Camera block in raytrace.frag.
+        struct CameraBlock {
+            glm::vec4 position, rotation;
+            glm::vec4 lastPosition, lastRotation;
+        };
+
+        static const int cameraBinding = 0;
 
         static int denoiserStep;
+        static int frameIndex;
+
+        // Whether the back frame's variance mips were generated, adaptive sampling reads their top level.
+        static bool errorMipmapped;
+
+        static View view;
+        static TT::UniformBuffer* cameraBuffer;
+
+        static glm::vec3 lastEyePosition, lastRotation;
+
+        static TT::FrameBuffer* raytrace(TT::TripleBuffer<View>& views);
+        static TT::FrameBuffer* denoise(TT::FrameBuffer* frameBuffer);
+        static void present(TT::FrameBuffer* resolvedFrameBuffer, TT::FrameBuffer* frameBuffer);
+        static void renderQuad();
+    };
+
+    // Holds a frame time target by trading rays per pixel first, then bounce depth, then render scale.
+    class Governor {
+    public:
+        static bool enabled;
+        static float targetFrameTime;
+        static int maxRaysPerPixel;
+
+        static void update(float cpuTime, float gpuTime);
+
+        static float getFrameTime();
+    private:
+        static float frameTime;
+        static int cooldown;
+
+        static bool degrade(float ratio);
+        static bool improve(float ratio);
     };
 
     class DebugHud {
@@ -143,5 +302,8 @@ namespace RTX {
     private:
         static bool frameScaleMode;
         static int frameScale;
+
+        static float tracerError;
+        static bool traceSaved;
     };
 }
\ No newline at end of file
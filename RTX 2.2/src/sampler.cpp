@@ -0,0 +1,95 @@
+#include "sampler.h"
+
+RTX::Sampler::Type RTX::Sampler::type = RTX::Sampler::Type::Sobol;
+unsigned int RTX::Sampler::scramble = 0;
+
+RTX::Sampler::Sampler(glm::uvec2 pixel, unsigned int index) {
+    seed = pcg(pixel.x + pcg(pixel.y)) ^ (scramble * 0x68e31da4u);
+
+    this->index = index;
+    dimension = 0;
+
+    state = pcg(seed ^ pcg(index));
+    hashSeed = (float)(seed & 0xffff) / 65536.0f * 492.38f + (float)index * 0.61803398875f;
+}
+
+float RTX::Sampler::get1D() {
+    if (type != Type::Sobol || dimension >= sobolDimensions) return next();
+
+    unsigned int shuffledIndex = nestedUniformScramble(index, pcg(seed ^ dimension));
+    unsigned int value = nestedUniformScramble(sobol(shuffledIndex, 0), pcg(seed ^ dimension ^ 0x9e3779b9u));
+
+    dimension++;
+    return toFloat(value);
+}
+glm::vec2 RTX::Sampler::get2D() {
+    if (type != Type::Sobol || dimension + 1 >= sobolDimensions) {
+        float x = next();
+        return glm::vec2(x, next());
+    }
+
+    unsigned int shuffledIndex = nestedUniformScramble(index, pcg(seed ^ dimension));
+    unsigned int x = nestedUniformScramble(sobol(shuffledIndex, 0), pcg(seed ^ dimension ^ 0x9e3779b9u));
+    unsigned int y = nestedUniformScramble(sobol(shuffledIndex, 1), pcg(seed ^ dimension ^ 0x85ebca6bu));
+
+    dimension += 2;
+    return glm::vec2(toFloat(x), toFloat(y));
+}
+
+unsigned int RTX::Sampler::pcg(unsigned int value) {
+    unsigned int state = value * 747796405u + 2891336453u;
+    unsigned int word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+
+    return (word >> 22u) ^ word;
+}
+
+float RTX::Sampler::next() {
+    dimension++;
+
+    if (type == Type::SineHash) {
+        hashSeed += 0.1f;
+
+        float value = glm::sin(glm::dot(glm::vec2(hashSeed), glm::vec2(12.9898f, 4.1414f))) * 43758.5453f;
+        return value - glm::floor(value);
+    }
+
+    state = state * 747796405u + 2891336453u;
+    unsigned int word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+
+    return toFloat((word >> 22u) ^ word);
+}
+
+unsigned int RTX::Sampler::reverseBits(unsigned int value) {
+    value = ((value >> 1) & 0x55555555u) | ((value & 0x55555555u) << 1);
+    value = ((value >> 2) & 0x33333333u) | ((value & 0x33333333u) << 2);
+    value = ((value >> 4) & 0x0f0f0f0fu) | ((value & 0x0f0f0f0fu) << 4);
+    value = ((value >> 8) & 0x00ff00ffu) | ((value & 0x00ff00ffu) << 8);
+
+    return (value >> 16) | (value << 16);
+}
+unsigned int RTX::Sampler::nestedUniformScramble(unsigned int value, unsigned int seed) {
+    value = reverseBits(value);
+
+    // Laine-Karras style hash, only ever flips a bit based on the bits below it, which is exactly an Owen scramble
+    // when applied to the reversed value.
+    value += seed;
+    value ^= value * 0x6c50b47cu;
+    value ^= value * 0xb82f1e52u;
+    value ^= value * 0xc7afe638u;
+    value ^= value * 0x8d22f6e6u;
+
+    return reverseBits(value);
+}
+unsigned int RTX::Sampler::sobol(unsigned int index, unsigned int dimension) {
+    if (dimension == 0) return reverseBits(index);
+
+    unsigned int result = 0;
+    for (unsigned int direction = 1u << 31; index != 0; index >>= 1, direction ^= direction >> 1)
+        if (index & 1) result ^= direction;
+
+    return result;
+}
+
+float RTX::Sampler::toFloat(unsigned int value) {
+    return (float)(value >> 8) / 16777216.0f;
+}
\ No newline at end of file
@@ -0,0 +1,40 @@
+#pragma once
+#include <GLM/glm.hpp>
+
+namespace RTX {
+    // Mirrors the sampler in res/shaders/raytrace.frag. Dimensions are drawn from Owen-scrambled Sobol points
+    // (Burley 2020), every dimension pair gets its own index shuffle so pairs do not correlate, and dimensions
+    // past the Sobol budget fall back to a PCG stream.
+    class Sampler {
+    public:
+        enum class Type {
+            Sobol,
+            Random,
+            SineHash
+        };
+
+        static Type type;
+        static unsigned int scramble;
+
+        Sampler(glm::uvec2 pixel, unsigned int index);
+
+        float get1D();
+        glm::vec2 get2D();
+
+        static unsigned int pcg(unsigned int value);
+    private:
+        const static unsigned int sobolDimensions = 16;
+
+        unsigned int seed, index, dimension;
+        unsigned int state;
+        float hashSeed;
+
+        float next();
+
+        static unsigned int reverseBits(unsigned int value);
+        static unsigned int nestedUniformScramble(unsigned int value, unsigned int seed);
+        static unsigned int sobol(unsigned int index, unsigned int dimension);
+
+        static float toFloat(unsigned int value);
+    };
+}
\ No newline at end of file
@@ -0,0 +1,494 @@
+#include <chrono>
+#include "tracer.h"
+#include "sampler.h"
+
+#define PI 3.1415926536f
+
+const static glm::vec3 sunColor = glm::vec3(1.0f, 0.7f, 0.4f) * 300.0f;
+const static float sunRadius = 0.001f;
+const static float sunExponent = 1.0f / sunRadius;
+const static float skyBrightness = 0.8f;
+const static int russianRouletteDepth = 3;
+
+int RTX::Tracer::raysPerPixel = 128;
+int RTX::Tracer::maxBounces = 64;
+int RTX::Tracer::tileSize = 16;
+bool RTX::Tracer::lightSampling = true;
+
+std::vector<glm::vec4> RTX::Tracer::pixels;
+glm::uvec2 RTX::Tracer::size = glm::uvec2(0);
+
+TT::Image RTX::Tracer::albedoImage = TT::Image(glm::vec4(1.0f));
+TT::Image RTX::Tracer::normalImage = TT::Image(glm::vec4(0.5f, 0.5f, 1.0f, 1.0f));
+TT::Image RTX::Tracer::skyboxImage = TT::Image(glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+bool RTX::Tracer::texturesLoaded = false;
+
+int RTX::Tracer::denoiserStep = 1;
+unsigned int RTX::Tracer::frameIndex = 0;
+
+std::atomic<unsigned long long> RTX::Tracer::rayCount = 0;
+std::atomic<unsigned long long> RTX::Tracer::primitiveTestCount = 0;
+thread_local unsigned long long RTX::Tracer::primitiveTests = 0;
+double RTX::Tracer::raysPerSecond = 0.0;
+double RTX::Tracer::frameTime = 0.0;
+
+void RTX::Tracer::initialize(glm::uvec2 size) {
+    resize(size);
+
+    // Decoded on the first render, most sessions never use the CPU tracer.
+    texturesLoaded = false;
+}
+void RTX::Tracer::resize(glm::uvec2 size) {
+    Tracer::size = size;
+
+    pixels.assign(size.x * size.y, glm::vec4(0.0f));
+    resetDenoiser();
+}
+void RTX::Tracer::reloadTextures() {
+    albedoImage.loadFromFile(World::map->albedoLocation.c_str());
+    normalImage.loadFromFile(World::map->normalLocation.c_str());
+    skyboxImage.loadFromFile(World::map->skyboxLocation.c_str());
+
+    texturesLoaded = true;
+}
+
+void RTX::Tracer::render(glm::vec3 eyePosition, glm::vec3 rotation) {
+    if (!texturesLoaded) reloadTextures();
+
+    auto start = std::chrono::high_resolution_clock::now();
+    unsigned long long startRayCount = rayCount;
+
+    float aspect = (float)size.x / (float)size.y;
+    float fovFactor = glm::tan(glm::radians(Camera::fov) / 2.0f);
+    bool resetBackFrame = denoiserStep <= 1;
+
+    // The focus ray is the same for every pixel, so it is cast once per frame instead of per fragment.
+    Ray focusRay = { eyePosition, glm::vec3(0.0f, 0.0f, 1.0f) };
+    rotate(focusRay.direction.y, focusRay.direction.z, -rotation.x);
+    rotate(focusRay.direction.x, focusRay.direction.z, -rotation.y);
+    rotate(focusRay.direction.z, focusRay.direction.y, -rotation.z);
+
+    unsigned long long focusRays = 0;
+    HitInfo focusHitInfo = rayCast(focusRay, focusRays);
+    rayCount += focusRays;
+
+    primitiveTestCount += primitiveTests;
+    primitiveTests = 0;
+
+    float focusDistance = focusHitInfo.hit ? focusHitInfo.distance : Camera::dofFocusDistance;
+
+    int tilesX = (size.x + tileSize - 1) / tileSize;
+    int tilesY = (size.y + tileSize - 1) / tileSize;
+
+    TT::ThreadPool::parallelFor(tilesX * tilesY, [&](int tile) {
+        unsigned long long rays = 0;
+
+        unsigned int startX = (tile % tilesX) * tileSize;
+        unsigned int startY = (tile / tilesX) * tileSize;
+
+        for (unsigned int y = startY; y < glm::min(startY + tileSize, size.y); y++) {
+            for (unsigned int x = startX; x < glm::min(startX + tileSize, size.x); x++) {
+                glm::vec2 uv = (glm::vec2(x, y) + 0.5f) / glm::vec2(size) * 2.0f - 1.0f;
+
+                glm::vec3 direction = glm::normalize(glm::vec3(glm::vec2(uv.x * aspect, uv.y) * fovFactor, 1.0f));
+
+                glm::vec3 color(0.0f);
+                for (int i = 0; i < raysPerPixel; i++) {
+                    Sampler sampler(glm::uvec2(x, y), frameIndex * raysPerPixel + i);
+
+                    Ray ray = cameraRay(direction, focusDistance, eyePosition, rotation, sampler);
+                    color += rayTrace(ray, sampler, rays);
+                }
+
+                color /= (float)raysPerPixel;
+
+                glm::vec4& pixel = pixels[y * size.x + x];
+                if (resetBackFrame) pixel = glm::vec4(color, 0.0f);
+
+                pixel.a += raysPerPixel;
+                pixel = glm::vec4(glm::mix(glm::vec3(pixel), color, raysPerPixel / pixel.a), pixel.a);
+            }
+        }
+
+        rayCount += rays;
+
+        primitiveTestCount += primitiveTests;
+        primitiveTests = 0;
+    });
+
+    std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
+
+    frameTime = elapsed.count();
+    raysPerSecond = (rayCount - startRayCount) / frameTime;
+
+    denoiserStep++;
+    frameIndex++;
+}
+void RTX::Tracer::clear() {
+    pixels.clear();
+    pixels.shrink_to_fit();
+
+    size = glm::uvec2(0);
+}
+
+void RTX::Tracer::resetDenoiser() {
+    denoiserStep = 1;
+    frameIndex = 0;
+}
+
+float RTX::Tracer::compare(const std::vector<glm::vec4>& reference) {
+    if (reference.size() != pixels.size() || pixels.empty()) return -1.0f;
+
+    double error = 0.0;
+    for (size_t i = 0; i < pixels.size(); i++) {
+        glm::vec3 delta = glm::vec3(pixels[i]) - glm::vec3(reference[i]);
+        error += glm::dot(delta, delta) / 3.0f;
+    }
+
+    return (float)glm::sqrt(error / pixels.size());
+}
+bool RTX::Tracer::saveToFile(const char* location) {
+    std::ofstream file(location, std::ios::binary);
+    if (!file.is_open()) return false;
+
+    file << "P6\n" << size.x << ' ' << size.y << "\n255\n";
+
+    for (int y = (int)size.y - 1; y >= 0; y--) {
+        for (unsigned int x = 0; x < size.x; x++) {
+            glm::vec3 color = glm::clamp(glm::vec3(pixels[y * size.x + x]), 0.0f, 1.0f);
+
+            file.put((char)(color.r * 255.0f + 0.5f));
+            file.put((char)(color.g * 255.0f + 0.5f));
+            file.put((char)(color.b * 255.0f + 0.5f));
+        }
+    }
+
+    return true;
+}
+
+const std::vector<glm::vec4>& RTX::Tracer::getPixels() {
+    return pixels;
+}
+glm::uvec2 RTX::Tracer::getSize() {
+    return size;
+}
+
+unsigned long long RTX::Tracer::getRayCount() {
+    return rayCount;
+}
+unsigned long long RTX::Tracer::getPrimitiveTestCount() {
+    return primitiveTestCount;
+}
+double RTX::Tracer::getRaysPerSecond() {
+    return raysPerSecond;
+}
+double RTX::Tracer::getFrameTime() {
+    return frameTime;
+}
+
+void RTX::Tracer::rotate(float& x, float& y, float angle) {
+    float radAngle = glm::radians(angle);
+
+    float sin = glm::sin(radAngle);
+    float cos = glm::cos(radAngle);
+
+    float rotatedX = x * cos - y * sin;
+    y = x * sin + y * cos;
+    x = rotatedX;
+}
+
+glm::vec3 RTX::Tracer::randomSphereDirection(Sampler& sampler) {
+    glm::vec2 random = sampler.get2D();
+
+    float x = random.x * 2.0f - 1.0f;
+    float phi = random.y * 6.28318530718f;
+
+    return glm::vec3(glm::sqrt(1.0f - x * x) * glm::vec2(glm::sin(phi), glm::cos(phi)), x);
+}
+
+glm::vec3 RTX::Tracer::sky(const Ray& ray) {
+    glm::vec2 skyUv = glm::vec2(glm::atan(ray.direction.z, ray.direction.x), glm::asin(glm::clamp(ray.direction.y, -1.0f, 1.0f)) * 2.0f);
+    skyUv = (skyUv / PI) / 2.0f + 0.5f;
+
+    return glm::vec3(skyboxImage.sample(skyUv)) * skyBrightness;
+}
+glm::vec3 RTX::Tracer::sun(glm::vec3 direction) {
+    glm::vec3 sunDirection = glm::normalize(glm::vec3(World::sunDirection[0], World::sunDirection[1], World::sunDirection[2]));
+    return sunColor * glm::pow(glm::clamp(glm::dot(direction, sunDirection), 0.0f, 1.0f), sunExponent);
+}
+
+glm::vec3 RTX::Tracer::sampleSun(Sampler& sampler) {
+    glm::vec2 random = sampler.get2D();
+
+    float cosTheta = glm::pow(random.x, 1.0f / (sunExponent + 1.0f));
+    float sinTheta = glm::sqrt(glm::max(1.0f - cosTheta * cosTheta, 0.0f));
+    float phi = random.y * 2.0f * PI;
+
+    glm::vec3 axis = glm::normalize(glm::vec3(World::sunDirection[0], World::sunDirection[1], World::sunDirection[2]));
+    float axisSign = axis.z >= 0.0f ? 1.0f : -1.0f;
+    float a = -1.0f / (axisSign + axis.z);
+    float b = axis.x * axis.y * a;
+
+    glm::vec3 tangent(1.0f + axisSign * axis.x * axis.x * a, axisSign * b, -axisSign * axis.x);
+    glm::vec3 bitangent(b, axisSign + axis.y * axis.y * a, -axis.y);
+
+    return (tangent * glm::cos(phi) + bitangent * glm::sin(phi)) * sinTheta + axis * cosTheta;
+}
+float RTX::Tracer::sunPdf(glm::vec3 direction) {
+    glm::vec3 sunDirection = glm::normalize(glm::vec3(World::sunDirection[0], World::sunDirection[1], World::sunDirection[2]));
+    return (sunExponent + 1.0f) / (2.0f * PI) * glm::pow(glm::clamp(glm::dot(direction, sunDirection), 0.0f, 1.0f), sunExponent);
+}
+float RTX::Tracer::diffusePdf(glm::vec3 direction, glm::vec3 normal, glm::vec3 reflected, float diffuse) {
+    glm::vec3 center = reflected * (1.0f - diffuse);
+    float centerDot = glm::dot(direction, center);
+
+    float distance = centerDot + glm::sqrt(glm::max(centerDot * centerDot - glm::dot(center, center) + diffuse * diffuse, 0.0f));
+    glm::vec3 hemisphere = (direction * distance - center) / diffuse;
+
+    float cosine = glm::dot(hemisphere, direction);
+    if (glm::dot(hemisphere, normal) <= 0.0f || cosine <= 0.0f) return 0.0f;
+
+    return distance * distance / (2.0f * PI * diffuse * diffuse * cosine);
+}
+
+RTX::HitInfo RTX::Tracer::checkSphere(const Ray& ray, const Sphere& sphere) {
+    glm::vec3 delta = ray.position - sphere.position;
+
+    float b = glm::dot(delta, ray.direction);
+    float h = b * b - (glm::dot(delta, delta) - sphere.radius * sphere.radius);
+    if (h < 0.0f) return { false, 0.0f, 0.0f, glm::vec3(0.0f), glm::vec2(0.0f), -1 };
+    h = glm::sqrt(h);
+
+    float distance = -b - h;
+
+    glm::vec3 normal = glm::normalize(ray.position + ray.direction * distance - sphere.position);
+
+    glm::vec2 texUv = glm::vec2(glm::atan(normal.z, normal.x), glm::asin(glm::clamp(normal.y, -1.0f, 1.0f)) * 2.0f);
+    texUv = (texUv / PI) / 2.0f + 0.5f;
+    texUv -= glm::floor(texUv);
+
+    const Material& material = World::map->materials[sphere.material];
+    texUv *= glm::vec2(material.uvInfo.z, material.uvInfo.w);
+    texUv += glm::vec2(material.uvInfo.x, material.uvInfo.y);
+
+    return { distance >= 0.0f, distance, -b + h, normal, texUv, sphere.material };
+}
+RTX::HitInfo RTX::Tracer::checkBox(const Ray& ray, const Box& box) {
+    glm::vec3 delta = ray.position - box.position - box.scale / 2.0f;
+
+    glm::vec3 m = 1.0f / ray.direction;
+    glm::vec3 n = m * delta;
+    glm::vec3 k = glm::abs(m) * box.scale / 2.0f;
+    glm::vec3 t1 = -n - k;
+    glm::vec3 t2 = -n + k;
+
+    float tN = glm::max(glm::max(t1.x, t1.y), t1.z);
+    float tF = glm::min(glm::min(t2.x, t2.y), t2.z);
+
+    if (tN > tF || tF < 0.0f) return { false, 0.0f, 0.0f, glm::vec3(0.0f), glm::vec2(0.0f), -1 };
+
+    glm::vec3 normal = ray.position + ray.direction * tN - box.position;
+    glm::vec3 face = -glm::sign(ray.direction) * glm::step(glm::vec3(t1.y, t1.z, t1.x), t1) * glm::step(glm::vec3(t1.z, t1.x, t1.y), t1);
+
+    glm::vec2 texUv;
+    if (face.y != 0.0f) texUv = glm::vec2(normal.x, normal.z);
+    else if (face.x != 0.0f) texUv = glm::vec2(normal.z, normal.y);
+    else texUv = glm::vec2(normal.x, normal.y);
+
+    texUv -= glm::floor(texUv);
+
+    const Material& material = World::map->materials[box.material];
+    texUv *= glm::vec2(material.uvInfo.z, material.uvInfo.w);
+    texUv += glm::vec2(material.uvInfo.x, material.uvInfo.y);
+
+    return { tN >= 0.0f, tN, tF, face, texUv, box.material };
+}
+RTX::HitInfo RTX::Tracer::checkPrimitive(const Ray& ray, int primitive) {
+    int boxCount = (int)World::map->boxes.size();
+    return primitive < boxCount ? checkBox(ray, World::map->boxes[primitive]) : checkSphere(ray, World::map->spheres[primitive - boxCount]);
+}
+RTX::HitInfo RTX::Tracer::rayCast(const Ray& ray, unsigned long long& rays, float maxDistance, bool anyHit) {
+    HitInfo hitInfo = { false, maxDistance, 0.0f, glm::vec3(0.0f), glm::vec2(0.0f), -1 };
+    rays++;
+
+    World::bvh->traverse(ray, hitInfo.distance, [&](int primitive) {
+        HitInfo primitiveHitInfo = checkPrimitive(ray, primitive);
+        primitiveTests++;
+
+        if (primitiveHitInfo.hit && primitiveHitInfo.distance < hitInfo.distance) {
+            hitInfo = primitiveHitInfo;
+            return anyHit;
+        }
+
+        return false;
+    });
+
+    return hitInfo;
+}
+
+glm::vec3 RTX::Tracer::rayTrace(Ray ray, Sampler& sampler, unsigned long long& rays) {
+    glm::vec3 color(1.0f);
+    glm::vec3 light(0.0f);
+
+    float lastPdf = 0.0f;
+
+    for (int i = 0; i < maxBounces; i++) {
+        HitInfo hitInfo = rayCast(ray, rays);
+        if (!hitInfo.hit) {
+            float weight = lastPdf > 0.0f ? powerHeuristic(lastPdf, sunPdf(ray.direction)) : 1.0f;
+            return light + color * (sky(ray) + sun(ray.direction) * weight);
+        }
+
+        const Material& material = World::map->materials[hitInfo.material];
+        color *= material.color;
+
+        glm::vec3 geometricNormal = hitInfo.normal;
+
+        if (glm::length(hitInfo.uv) > 0.0f) {
+            color *= glm::vec3(albedoImage.sample(hitInfo.uv));
+
+            glm::vec3 texturedNormal = glm::vec3(normalImage.sample(hitInfo.uv)) * 2.0f - 1.0f;
+            glm::vec3 tangent = hitInfo.normal;
+            rotate(tangent.y, tangent.x, -90.0f);
+
+            glm::vec3 bitangent = hitInfo.normal;
+            rotate(bitangent.y, bitangent.z, -90.0f);
+
+            glm::mat3 tangentMatrix(
+                tangent.x, bitangent.x, hitInfo.normal.x,
+                tangent.y, bitangent.y, -hitInfo.normal.y,
+                tangent.z, bitangent.z, hitInfo.normal.z
+            );
+
+            hitInfo.normal = glm::normalize(-texturedNormal * tangentMatrix);
+        }
+
+        if (material.emissive) {
+            if (lastPdf <= 0.0f || World::lights->power <= 0.0f) return light + color;
+
+            float lightPdf = LightList::getLuminance(material.color) * hitInfo.distance * hitInfo.distance / (World::lights->power * glm::abs(glm::dot(geometricNormal, ray.direction)));
+            return light + color * powerHeuristic(lastPdf, lightPdf);
+        }
+
+        float fresnel = glm::pow(glm::clamp(1.0f - glm::dot(hitInfo.normal, -ray.direction), 0.0f, 1.0f), 1.0f + material.glass);
+        float reflectChance = sampler.get1D() * (fresnel + material.glassReflect);
+        lastPdf = 0.0f;
+
+        if (material.glass > 0.0f && reflectChance < 0.5f) {
+            ray.position += ray.direction * (hitInfo.farDistance - 0.001f);
+
+            glm::vec3 refracted = glm::refract(ray.direction, hitInfo.normal, 1.0f - material.glass);
+            ray.direction = randomSphereDirection(sampler);
+            ray.direction *= glm::sign(glm::dot(ray.direction, -hitInfo.normal));
+            ray.direction = glm::mix(refracted, ray.direction, material.diffuse);
+        }
+        else {
+            ray.position += ray.direction * (hitInfo.distance - 0.001f);
+
+            glm::vec3 reflected = glm::reflect(ray.direction, hitInfo.normal);
+
+            if (lightSampling && material.diffuse >= 0.5f) {
+                glm::vec3 lightDirection = sampleSun(sampler);
+                float bouncePdf = diffusePdf(lightDirection, hitInfo.normal, reflected, material.diffuse);
+
+                if (bouncePdf > 0.0f && !rayCast({ ray.position, lightDirection }, rays, 1000000.0f, true).hit) {
+                    float lightPdf = sunPdf(lightDirection);
+                    light += color * sun(lightDirection) * bouncePdf / lightPdf * powerHeuristic(lightPdf, bouncePdf);
+                }
+
+                if (!World::lights->lights.empty()) {
+                    int primitive;
+                    glm::vec3 lightPoint = sampleLight(sampler, primitive);
+
+                    Ray lightRay = { ray.position, glm::normalize(lightPoint - ray.position) };
+                    HitInfo lightHitInfo = checkPrimitive(lightRay, primitive);
+
+                    float lightDistance = glm::length(lightPoint - ray.position);
+                    bool visible = lightHitInfo.hit && glm::abs(lightHitInfo.distance - lightDistance) < lightDistance * 0.001f + 0.001f;
+
+                    bouncePdf = diffusePdf(lightRay.direction, hitInfo.normal, reflected, material.diffuse);
+                    float cosine = glm::abs(glm::dot(lightHitInfo.normal, lightRay.direction));
+
+                    if (visible && bouncePdf > 0.0f && cosine > 0.0f && !rayCast(lightRay, rays, lightHitInfo.distance * 0.999f, true).hit) {
+                        const Material& lightMaterial = World::map->materials[lightHitInfo.material];
+
+                        glm::vec3 emission = lightMaterial.color;
+                        if (glm::length(lightHitInfo.uv) > 0.0f) emission *= glm::vec3(albedoImage.sample(lightHitInfo.uv));
+
+                        float lightPdf = LightList::getLuminance(lightMaterial.color) * lightHitInfo.distance * lightHitInfo.distance / (World::lights->power * cosine);
+                        light += color * emission * bouncePdf / lightPdf * powerHeuristic(lightPdf, bouncePdf);
+                    }
+                }
+            }
+
+            ray.direction = randomSphereDirection(sampler);
+            ray.direction *= glm::sign(glm::dot(ray.direction, hitInfo.normal));
+            ray.direction = glm::normalize(glm::mix(reflected, ray.direction, material.diffuse));
+
+            if (lightSampling && material.diffuse >= 0.5f) lastPdf = diffusePdf(ray.direction, hitInfo.normal, reflected, material.diffuse);
+        }
+
+        ray.direction = glm::normalize(ray.direction);
+
+        if (i >= russianRouletteDepth) {
+            float survival = glm::clamp(glm::max(color.r, glm::max(color.g, color.b)), 0.05f, 1.0f);
+            if (sampler.get1D() >= survival) break;
+
+            color /= survival;
+        }
+    }
+
+    return light;
+}
+glm::vec3 RTX::Tracer::sampleLight(Sampler& sampler, int& primitive) {
+    primitive = World::lights->lights[World::lights->sample(sampler.get1D())].primitive;
+
+    float faceRandom = sampler.get1D();
+    glm::vec2 pointRandom = sampler.get2D();
+
+    int boxCount = (int)World::map->boxes.size();
+    if (primitive >= boxCount) {
+        const Sphere& sphere = World::map->spheres[primitive - boxCount];
+
+        float z = pointRandom.x * 2.0f - 1.0f;
+        float phi = pointRandom.y * 2.0f * PI;
+
+        return sphere.position + glm::vec3(glm::sqrt(1.0f - z * z) * glm::vec2(glm::cos(phi), glm::sin(phi)), z) * sphere.radius;
+    }
+
+    const Box& box = World::map->boxes[primitive];
+
+    glm::vec3 faceAreas = glm::vec3(box.scale.y, box.scale.z, box.scale.x) * glm::vec3(box.scale.z, box.scale.x, box.scale.y);
+    float face = faceRandom * (faceAreas.x + faceAreas.y + faceAreas.z);
+
+    if (face < faceAreas.x) return box.position + glm::vec3(glm::step(faceAreas.x * 0.5f, face), pointRandom) * box.scale;
+
+    face -= faceAreas.x;
+    if (face < faceAreas.y) return box.position + glm::vec3(pointRandom.y, glm::step(faceAreas.y * 0.5f, face), pointRandom.x) * box.scale;
+
+    face -= faceAreas.y;
+    return box.position + glm::vec3(pointRandom, glm::step(faceAreas.z * 0.5f, face)) * box.scale;
+}
+float RTX::Tracer::powerHeuristic(float pdf, float otherPdf) {
+    return pdf * pdf / (pdf * pdf + otherPdf * otherPdf);
+}
+
+RTX::Ray RTX::Tracer::cameraRay(glm::vec3 direction, float focusDistance, glm::vec3 eyePosition, glm::vec3 rotation, Sampler& sampler) {
+    glm::vec2 randomPoint = glm::vec2(randomSphereDirection(sampler)) * Camera::dofBlurSize;
+    glm::vec3 focusPoint = direction * focusDistance;
+
+    Ray ray = { glm::vec3(randomPoint * focusDistance, 0.0f), glm::vec3(0.0f) };
+    ray.direction = glm::normalize(focusPoint - ray.position);
+
+    rotate(ray.position.y, ray.position.x, -rotation.z);
+    rotate(ray.position.y, ray.position.z, -rotation.x);
+    rotate(ray.position.x, ray.position.z, -rotation.y);
+
+    rotate(ray.direction.y, ray.direction.x, -rotation.z);
+    rotate(ray.direction.y, ray.direction.z, -rotation.x);
+    rotate(ray.direction.x, ray.direction.z, -rotation.y);
+
+    ray.position += eyePosition;
+
+    return ray;
+}
\ No newline at end of file
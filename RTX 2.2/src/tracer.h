@@ -0,0 +1,84 @@
+#pragma once
+#include <atomic>
+#include "engine/threading.h"
+#include "bvh.h"
+#include "sampler.h"
+#include "lights.h"
+
+namespace RTX {
+    struct HitInfo {
+        bool hit;
+
+        float distance;
+        float farDistance;
+
+        glm::vec3 normal;
+        glm::vec2 uv;
+
+        int material;
+    };
+
+    // CPU port of res/shaders/raytrace.frag, renders the same image tile by tile on TT::ThreadPool.
+    class Tracer {
+    public:
+        static int raysPerPixel;
+        static int maxBounces;
+        static int tileSize;
+        static bool lightSampling;
+
+        static void initialize(glm::uvec2 size);
+        static void resize(glm::uvec2 size);
+        static void reloadTextures();
+
+        static void render(glm::vec3 eyePosition, glm::vec3 rotation);
+        static void clear();
+
+        static void resetDenoiser();
+
+        static float compare(const std::vector<glm::vec4>& reference);
+        static bool saveToFile(const char* location);
+
+        static const std::vector<glm::vec4>& getPixels();
+        static glm::uvec2 getSize();
+
+        static unsigned long long getRayCount();
+        static unsigned long long getPrimitiveTestCount();
+        static double getRaysPerSecond();
+        static double getFrameTime();
+
+        static HitInfo checkSphere(const Ray& ray, const Sphere& sphere);
+        static HitInfo checkBox(const Ray& ray, const Box& box);
+        static HitInfo checkPrimitive(const Ray& ray, int primitive);
+        static HitInfo rayCast(const Ray& ray, unsigned long long& rays, float maxDistance = 1000000.0f, bool anyHit = false);
+    private:
+        static std::vector<glm::vec4> pixels;
+        static glm::uvec2 size;
+
+        static TT::Image albedoImage, normalImage, skyboxImage;
+        static bool texturesLoaded;
+
+        static int denoiserStep;
+        static unsigned int frameIndex;
+
+        static std::atomic<unsigned long long> rayCount, primitiveTestCount;
+        static thread_local unsigned long long primitiveTests;
+        static double raysPerSecond, frameTime;
+
+        static void rotate(float& x, float& y, float angle);
+
+        static glm::vec3 randomSphereDirection(Sampler& sampler);
+
+        static glm::vec3 sky(const Ray& ray);
+        static glm::vec3 sun(glm::vec3 direction);
+
+        static glm::vec3 sampleSun(Sampler& sampler);
+        static float sunPdf(glm::vec3 direction);
+        static float diffusePdf(glm::vec3 direction, glm::vec3 normal, glm::vec3 reflected, float diffuse);
+
+        static glm::vec3 sampleLight(Sampler& sampler, int& primitive);
+        static float powerHeuristic(float pdf, float otherPdf);
+
+        static Ray cameraRay(glm::vec3 direction, float focusDistance, glm::vec3 eyePosition, glm::vec3 rotation, Sampler& sampler);
+        static glm::vec3 rayTrace(Ray ray, Sampler& sampler, unsigned long long& rays);
+    };
+}
\ No newline at end of file